@@ -0,0 +1,797 @@
+#ifndef P2_CAPIGEN_H
+#  define P2_CAPIGEN_H
+
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+#include "indentstream.h"
+#include "parsefile.h"
+
+namespace proj2 {
+
+// Python.h has to come before any standard header, then what the runtime below uses
+constexpr char const* capi_includes = R"c++(#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <exception>
+#include <limits>
+#include <map>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+)c++";
+
+// Defined once per generated .cpp with METH_FASTCALL wrappers (the capi backend or --fast-calls), guarded for unity builds
+constexpr char const* fastcall_support = R"c++(#ifndef P2_FASTCALL
+#  define P2_FASTCALL
+// DIRECT CONVERSIONS OF BUILTIN ARGUMENTS & RESULTS, out is only written on success
+namespace {
+
+inline bool p2_check_nargs(char const* function, Py_ssize_t nargs, Py_ssize_t expected) {
+    if (nargs == expected)
+        return true;
+    PyErr_Format(PyExc_TypeError, "%s() takes %zd positional arguments but %zd were given", function, expected, nargs);
+    return false;
+}
+
+template <typename Int>
+bool p2_as_integer(PyObject* obj, Int& out) {
+    if constexpr (std::is_signed_v<Int>) {
+        long const value = PyLong_AsLong(obj);
+        if (value == -1 && PyErr_Occurred())
+            return false;
+        if (value < std::numeric_limits<Int>::min() || value > std::numeric_limits<Int>::max()) {
+            PyErr_SetString(PyExc_OverflowError, "integer out of range");
+            return false;
+        }
+        out = static_cast<Int>(value);
+    } else {
+        unsigned long const value = PyLong_AsUnsignedLong(obj);
+        if (value == static_cast<unsigned long>(-1) && PyErr_Occurred())
+            return false;
+        if (value > std::numeric_limits<Int>::max()) {
+            PyErr_SetString(PyExc_OverflowError, "integer out of range");
+            return false;
+        }
+        out = static_cast<Int>(value);
+    }
+    return true;
+}
+
+inline bool p2_as_uchar (PyObject* obj, unsigned char&  out) { return p2_as_integer(obj, out); }
+inline bool p2_as_short (PyObject* obj, short&          out) { return p2_as_integer(obj, out); }
+inline bool p2_as_ushort(PyObject* obj, unsigned short& out) { return p2_as_integer(obj, out); }
+inline bool p2_as_int   (PyObject* obj, int&            out) { return p2_as_integer(obj, out); }
+inline bool p2_as_uint  (PyObject* obj, unsigned int&   out) { return p2_as_integer(obj, out); }
+inline bool p2_as_long  (PyObject* obj, long&           out) { return p2_as_integer(obj, out); }
+inline bool p2_as_ulong (PyObject* obj, unsigned long&  out) { return p2_as_integer(obj, out); }
+
+inline bool p2_as_double(PyObject* obj, double& out) {
+    double const value = PyFloat_AsDouble(obj);
+    if (value == -1.0 && PyErr_Occurred())
+        return false;
+    out = value;
+    return true;
+}
+
+inline bool p2_as_float(PyObject* obj, float& out) {
+    double const value = PyFloat_AsDouble(obj);
+    if (value == -1.0 && PyErr_Occurred())
+        return false;
+    out = static_cast<float>(value);
+    return true;
+}
+
+inline bool p2_as_string(PyObject* obj, std::string& out) {
+    Py_ssize_t size;
+    char const* utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+    if (utf8 == nullptr)
+        return false;
+    out.assign(utf8, static_cast<std::size_t>(size));
+    return true;
+}
+
+inline bool p2_as_char(PyObject* obj, char& out) {
+    Py_ssize_t size;
+    char const* utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+    if (utf8 == nullptr)
+        return false;
+    if (size != 1) {
+        PyErr_SetString(PyExc_ValueError, "expected a single character");
+        return false;
+    }
+    out = utf8[0];
+    return true;
+}
+
+// Note: points into obj's cached utf-8, valid while the caller holds obj, e.g. for the duration of a call
+inline bool p2_as_cstring(PyObject* obj, char const*& out) {
+    char const* utf8 = PyUnicode_AsUTF8(obj);
+    if (utf8 == nullptr)
+        return false;
+    out = utf8;
+    return true;
+}
+
+inline PyObject* p2_str_from_cstring(char const* value) {
+    if (value == nullptr)
+        Py_RETURN_NONE;
+    return PyUnicode_FromString(value);
+}
+
+inline PyObject* p2_str_from_char(char value) {
+    return PyUnicode_FromStringAndSize(&value, 1);
+}
+
+inline PyObject* p2_str_from_string(std::string const& value) {
+    return PyUnicode_FromStringAndSize(value.data(), static_cast<Py_ssize_t>(value.size()));
+}
+
+}
+#endif
+
+)c++";
+
+// Defined once per generated .cpp of the capi backend, guarded for unity builds
+constexpr char const* capi_runtime_support = R"c++(#ifndef P2_CAPI_RUNTIME
+#  define P2_CAPI_RUNTIME
+// CPYTHON RUNTIME SHARED BY THE BINDINGS BELOW
+// Note: internal linkage, p2_class<T>::type would otherwise be one symbol shared by every loaded module binding a T
+namespace {
+
+// A struct instance either owns its value or refers to one it doesn't own, e.g. a member of another instance
+template <typename T>
+struct p2_instance {
+    PyObject_HEAD
+    T*        value;
+    PyObject* owner; // kept alive while value points into it, may be nullptr
+    bool      owned; // value lives in storage
+    alignas(T) unsigned char storage[sizeof(T)];
+};
+
+template <typename T>
+struct p2_class {
+    static inline PyTypeObject* type = nullptr; // set by p2_add_class() when the module is imported
+};
+
+template <typename T>
+T& p2_self(PyObject* self) {
+    return *reinterpret_cast<p2_instance<T>*>(self)->value;
+}
+
+template <typename T>
+void p2_dealloc(PyObject* obj) {
+    auto* self = reinterpret_cast<p2_instance<T>*>(obj);
+    PyTypeObject* type = Py_TYPE(obj);
+    if (self->owned)
+        self->value->~T();
+    Py_XDECREF(self->owner);
+    type->tp_free(obj);
+    Py_DECREF(type); // instances of heap types hold a reference to their type
+}
+
+template <typename T, typename... Args>
+PyObject* p2_construct(PyTypeObject* type, Args&&... args) {
+    auto* self = reinterpret_cast<p2_instance<T>*>(type->tp_alloc(type, 0));
+    if (self == nullptr)
+        return nullptr;
+    try {
+        self->value = new (self->storage) T(std::forward<Args>(args)...);
+        self->owned = true;
+    } catch (std::exception const& e) {
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return nullptr;
+    } catch (...) { // nothing may escape into the interpreter
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_RuntimeError, "unidentifiable C++ exception");
+        return nullptr;
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+template <typename T>
+PyObject* p2_new(PyTypeObject* type, PyObject*, PyObject*) {
+    return p2_construct<T>(type);
+}
+
+template <typename T>
+PyObject* p2_wrap_copy(T const& value) {
+    return p2_construct<T>(p2_class<T>::type, value);
+}
+
+// Note: the caller guarantees *value outlives the python object, unless owner keeps it alive
+template <typename T>
+PyObject* p2_wrap_ref(T* value, PyObject* owner) {
+    if (value == nullptr)
+        Py_RETURN_NONE;
+    PyTypeObject* type = p2_class<T>::type;
+    auto* self = reinterpret_cast<p2_instance<T>*>(type->tp_alloc(type, 0));
+    if (self == nullptr)
+        return nullptr;
+    self->value = value;
+    self->owner = owner;
+    Py_XINCREF(owner);
+    return reinterpret_cast<PyObject*>(self);
+}
+
+template <typename T>
+T* p2_unwrap(PyObject* obj) {
+    PyTypeObject* type = p2_class<T>::type;
+    if (type == nullptr || !PyObject_TypeCheck(obj, type)) {
+        PyErr_Format(PyExc_TypeError, "expected %s, got %s", type ? type->tp_name : "a registered class", Py_TYPE(obj)->tp_name);
+        return nullptr;
+    }
+    return reinterpret_cast<p2_instance<T>*>(obj)->value;
+}
+
+template <typename T>
+bool p2_add_class(PyObject* module, PyType_Spec* spec, char const* name) {
+    PyObject* type = PyType_FromSpec(spec);
+    if (type == nullptr)
+        return false;
+    p2_class<T>::type = reinterpret_cast<PyTypeObject*>(type);
+    Py_INCREF(type); // p2_class keeps one, PyModule_AddObject steals the other
+    if (PyModule_AddObject(module, name, type) != 0) {
+        Py_DECREF(type);
+        return false;
+    }
+    return true;
+}
+
+inline bool p2_check_delete(PyObject* value) {
+    if (value != nullptr)
+        return true;
+    PyErr_SetString(PyExc_AttributeError, "can't delete attribute");
+    return false;
+}
+
+// CONTAINER ELEMENTS, std::vector <-> list and std::map <-> dict, both copy
+inline bool p2_from_python(PyObject* obj, char&           out) { return p2_as_char  (obj, out); }
+inline bool p2_from_python(PyObject* obj, unsigned char&  out) { return p2_as_uchar (obj, out); }
+inline bool p2_from_python(PyObject* obj, short&          out) { return p2_as_short (obj, out); }
+inline bool p2_from_python(PyObject* obj, unsigned short& out) { return p2_as_ushort(obj, out); }
+inline bool p2_from_python(PyObject* obj, int&            out) { return p2_as_int   (obj, out); }
+inline bool p2_from_python(PyObject* obj, unsigned int&   out) { return p2_as_uint  (obj, out); }
+inline bool p2_from_python(PyObject* obj, long&           out) { return p2_as_long  (obj, out); }
+inline bool p2_from_python(PyObject* obj, unsigned long&  out) { return p2_as_ulong (obj, out); }
+inline bool p2_from_python(PyObject* obj, float&          out) { return p2_as_float (obj, out); }
+inline bool p2_from_python(PyObject* obj, double&         out) { return p2_as_double(obj, out); }
+inline bool p2_from_python(PyObject* obj, std::string&    out) { return p2_as_string(obj, out); }
+
+template <typename T>
+bool p2_from_python(PyObject* obj, T& out) {
+    T* value = p2_unwrap<T>(obj);
+    if (value == nullptr)
+        return false;
+    out = *value;
+    return true;
+}
+
+template <typename T>
+bool p2_from_python(PyObject* obj, std::vector<T>& out) {
+    PyObject* seq = PySequence_Fast(obj, "expected a sequence");
+    if (seq == nullptr)
+        return false;
+    Py_ssize_t const size = PySequence_Fast_GET_SIZE(seq);
+    PyObject** items = PySequence_Fast_ITEMS(seq);
+    std::vector<T> values;
+    values.reserve(static_cast<std::size_t>(size));
+    for (Py_ssize_t i = 0; i < size; ++i) {
+        T value;
+        if (!p2_from_python(items[i], value)) {
+            Py_DECREF(seq);
+            return false;
+        }
+        values.push_back(std::move(value));
+    }
+    Py_DECREF(seq);
+    out = std::move(values);
+    return true;
+}
+
+template <typename K, typename V>
+bool p2_from_python(PyObject* obj, std::map<K, V>& out) {
+    if (!PyDict_Check(obj)) {
+        PyErr_Format(PyExc_TypeError, "expected a dict, got %s", Py_TYPE(obj)->tp_name);
+        return false;
+    }
+    std::map<K, V> values;
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(obj, &pos, &key, &value)) {
+        K k;
+        V v;
+        if (!p2_from_python(key, k) || !p2_from_python(value, v))
+            return false;
+        values.emplace(std::move(k), std::move(v));
+    }
+    out = std::move(values);
+    return true;
+}
+
+inline PyObject* p2_to_python(char                  value) { return p2_str_from_char(value);       }
+inline PyObject* p2_to_python(unsigned char         value) { return PyLong_FromUnsignedLong(value); }
+inline PyObject* p2_to_python(short                 value) { return PyLong_FromLong(value);         }
+inline PyObject* p2_to_python(unsigned short        value) { return PyLong_FromUnsignedLong(value); }
+inline PyObject* p2_to_python(int                   value) { return PyLong_FromLong(value);         }
+inline PyObject* p2_to_python(unsigned int          value) { return PyLong_FromUnsignedLong(value); }
+inline PyObject* p2_to_python(long                  value) { return PyLong_FromLong(value);         }
+inline PyObject* p2_to_python(unsigned long         value) { return PyLong_FromUnsignedLong(value); }
+inline PyObject* p2_to_python(float                 value) { return PyFloat_FromDouble(value);      }
+inline PyObject* p2_to_python(double                value) { return PyFloat_FromDouble(value);      }
+inline PyObject* p2_to_python(std::string const&    value) { return p2_str_from_string(value);      }
+
+template <typename T>
+PyObject* p2_to_python(T const& value) {
+    return p2_wrap_copy(value);
+}
+
+template <typename T>
+PyObject* p2_to_python(std::vector<T> const& values) {
+    PyObject* list = PyList_New(static_cast<Py_ssize_t>(values.size()));
+    if (list == nullptr)
+        return nullptr;
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        PyObject* item = p2_to_python(values[i]);
+        if (item == nullptr) {
+            Py_DECREF(list);
+            return nullptr;
+        }
+        PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), item);
+    }
+    return list;
+}
+
+template <typename K, typename V>
+PyObject* p2_to_python(std::map<K, V> const& values) {
+    PyObject* dict = PyDict_New();
+    if (dict == nullptr)
+        return nullptr;
+    for (auto const& [k, v] : values) {
+        PyObject* key   = p2_to_python(k);
+        PyObject* value = key ? p2_to_python(v) : nullptr;
+        int const failed = value ? PyDict_SetItem(dict, key, value) : -1;
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+        if (failed) {
+            Py_DECREF(dict);
+            return nullptr;
+        }
+    }
+    return dict;
+}
+
+// RELEASES THE GIL AROUND THE C++ CALL, restore() takes it back before the result is converted
+struct p2_gil_release {
+    PyThreadState* state;
+    p2_gil_release() : state(PyEval_SaveThread()) {}
+    ~p2_gil_release() { restore(); }
+    p2_gil_release(p2_gil_release const&) = delete;
+    p2_gil_release& operator=(p2_gil_release const&) = delete;
+
+    void restore() {
+        if (state != nullptr)
+            PyEval_RestoreThread(std::exchange(state, nullptr));
+    }
+};
+
+}
+#endif
+
+)c++";
+
+// char const* is a python str, like boost python does it
+constexpr bool is_cstring(ast_type_basic const& tb) {
+    return tb.type == type_t::t_char && !tb.mod_unsigned && tb.mod_const && tb.mod_ptr && !tb.mod_ref;
+}
+
+// How a builtin type_t crosses the boundary in a METH_FASTCALL wrapper, the functions are in fastcall_support
+struct scalar_converter {
+    char const* spelling;
+    char const* from_python; // bool (PyObject*, T& out)
+    char const* to_python;   // PyObject* (T)
+};
+
+inline scalar_converter const* scalar_converter_for(ast_type_basic const& tb) {
+    static constexpr scalar_converter table[] = {
+        { "char",           "p2_as_char",   "p2_str_from_char"        },
+        { "unsigned char",  "p2_as_uchar",  "PyLong_FromUnsignedLong" },
+        { "short",          "p2_as_short",  "PyLong_FromLong"         },
+        { "unsigned short", "p2_as_ushort", "PyLong_FromUnsignedLong" },
+        { "int",            "p2_as_int",    "PyLong_FromLong"         },
+        { "unsigned int",   "p2_as_uint",   "PyLong_FromUnsignedLong" },
+        { "long",           "p2_as_long",   "PyLong_FromLong"         },
+        { "unsigned long",  "p2_as_ulong",  "PyLong_FromUnsignedLong" },
+        { "float",          "p2_as_float",  "PyFloat_FromDouble"      },
+        { "double",         "p2_as_double", "PyFloat_FromDouble"      },
+        { "std::string",    "p2_as_string", "p2_str_from_string"      },
+        { "char const*",    "p2_as_cstring","p2_str_from_cstring"     },
+    };
+    bool const u = tb.mod_unsigned;
+    if (is_cstring(tb))
+        return &table[11];
+    switch (tb.type) {
+        case type_t::t_char              : return &table[u ? 1 : 0];
+        case type_t::t_short             : return &table[u ? 3 : 2];
+        case type_t::t_int               : return &table[u ? 5 : 4];
+        case type_t::t_long              : return &table[u ? 7 : 6];
+        case type_t::t_float             : return &table[8];
+        case type_t::t_double            : return &table[9];
+        case type_t::t_string            : return &table[10];
+        default                          : return nullptr;
+    };
+}
+
+// Binding section of the capi backend (--backend capi): the module is written directly against the CPython
+// C API, a heap PyTypeObject per struct & a METH_FASTCALL wrapper per function, so it builds with only
+// the Python headers. The converter of each scalar parameter, member & result is picked here from its type_t.
+// Note: anything without a sensible by value mapping (pointers to scalars, non-const references to scalars or
+// containers, tuples...) is left out with a "NOT BOUND" comment
+class capi_generator {
+    bool known_struct(ast_type_basic const& tb) const {
+        return tb.type == type_t::t_custom && structs.count(tb.custom_typename.id) != 0;
+    }
+
+    // container elements are copied in & out, so only plain values
+    bool element_supported(ast_type_basic const& tb) const {
+        return !tb.mod_const && !tb.mod_ptr && !tb.mod_ref && (scalar_converter_for(tb) != nullptr || known_struct(tb));
+    }
+
+    bool container_supported(ast_type_container const& tc) const {
+        std::size_t const arity = tc.type == container_t::c_vector ? 1 : tc.type == container_t::c_map ? 2 : 0;
+        if (arity == 0 || tc.template_types.size() != arity)
+            return false;
+        for (auto const& tb : tc.template_types) {
+            if (!element_supported(tb))
+                return false;
+        }
+        return true;
+    }
+
+    static std::string value_spelling(ast_type_basic const& tb) {
+        if (tb.type == type_t::t_custom)
+            return std::string(tb.custom_typename.spelling);
+        return scalar_converter_for(tb)->spelling;
+    }
+
+    static std::string value_spelling(ast_type_container const& tc) {
+        std::string s = tc.type == container_t::c_map ? "std::map<" : "std::vector<";
+        for (auto tb = tc.template_types.cbegin(); tb != tc.template_types.cend(); tb++) {
+            if (tb != tc.template_types.cbegin())
+                s += ", ";
+            s += value_spelling(*tb);
+        }
+        return s + '>';
+    }
+
+    // empty if the parameter can be bound
+    std::string_view param_unsupported(ast_variable const& param) const {
+        return std::visit(overloaded {
+            [this](ast_basic_variable const& bv) -> std::string_view {
+                ast_type_basic const& tb = bv.type;
+                if (known_struct(tb))
+                    return {};
+                if (tb.type == type_t::t_custom)
+                    return "a type that isn't a struct of this header";
+                if (scalar_converter_for(tb) == nullptr)
+                    return "an unsupported type";
+                if (is_cstring(tb))
+                    return {};
+                if (tb.mod_ptr || (tb.mod_ref && !tb.mod_const))
+                    return "a scalar passed by pointer or non-const reference";
+                return {};
+            },
+            [this](ast_container const& con) -> std::string_view {
+                if (!container_supported(con.type))
+                    return "an unsupported container";
+                if (con.type.mod_ptr || (con.type.mod_ref && !con.type.mod_const))
+                    return "a container passed by pointer or non-const reference";
+                return {};
+            }
+        }, param);
+    }
+
+    std::string_view result_unsupported(ast_type const& result) const {
+        return std::visit(overloaded {
+            [this](ast_type_basic const& tb) -> std::string_view {
+                if (tb.type == type_t::t_void)
+                    return tb.mod_ptr ? "a void* result" : std::string_view();
+                if (known_struct(tb))
+                    return {};
+                if (tb.type == type_t::t_custom)
+                    return "a result type that isn't a struct of this header";
+                if (scalar_converter_for(tb) == nullptr)
+                    return "an unsupported result type";
+                if (tb.mod_ptr && !is_cstring(tb))
+                    return "a scalar result by pointer";
+                return {};
+            },
+            [this](ast_type_container const& tc) -> std::string_view {
+                if (!container_supported(tc))
+                    return "an unsupported container result";
+                if (tc.mod_ptr)
+                    return "a container result by pointer";
+                return {};
+            }
+        }, result);
+    }
+
+    static interned_string variable_name(ast_variable const& var) {
+        return std::visit([](auto const& v){ return v.name; }, var);
+    }
+
+    // converts args[i] into the local a<i>, returns the expression the call passes
+    std::string argument(ast_variable const& param, std::size_t i) {
+        std::string const local = "a" + std::to_string(i);
+        std::string const arg   = "args[" + std::to_string(i) + "]";
+        return std::visit(overloaded {
+            [&](ast_basic_variable const& bv) -> std::string {
+                ast_type_basic const& tb = bv.type;
+                if (tb.type == type_t::t_custom) {
+                    if (tb.mod_ptr) {
+                        out << tb.custom_typename << "* " << local << " = nullptr;\n"
+                            << "if (" << arg << " != Py_None && !(" << local << " = p2_unwrap<" << tb.custom_typename << ">(" << arg << ")))\n"
+                            << "    return nullptr;\n";
+                        return local;
+                    }
+                    out << tb.custom_typename << "* " << local << " = p2_unwrap<" << tb.custom_typename << ">(" << arg << ");\n"
+                        << "if (" << local << " == nullptr)\n"
+                        << "    return nullptr;\n";
+                    return '*' + local;
+                }
+                scalar_converter const* s = scalar_converter_for(tb);
+                out << s->spelling << ' ' << local << ";\n"
+                    << "if (!" << s->from_python << '(' << arg << ", " << local << "))\n"
+                    << "    return nullptr;\n";
+                return local;
+            },
+            [&](ast_container const& con) -> std::string {
+                out << value_spelling(con.type) << ' ' << local << ";\n"
+                    << "if (!p2_from_python(" << arg << ", " << local << "))\n"
+                    << "    return nullptr;\n";
+                return con.type.mod_ref ? local : "std::move(" + local + ')';
+            }
+        }, param);
+    }
+
+    // the python object for the value `result` is bound to
+    static std::string result_to_python(ast_type const& result) {
+        return std::visit(overloaded {
+            [](ast_type_basic const& tb) -> std::string {
+                if (tb.type == type_t::t_custom) {
+                    if (tb.mod_ptr) // reference_existing_object, like the boost python backend
+                        return "p2_wrap_ref(result, nullptr)";
+                    if (tb.mod_ref && !tb.mod_const)
+                        return "p2_wrap_ref(&result, nullptr)";
+                    return "p2_wrap_copy(result)";
+                }
+                return std::string(scalar_converter_for(tb)->to_python) + "(result)";
+            },
+            [](ast_type_container const&) -> std::string {
+                return "p2_to_python(result)";
+            }
+        }, result);
+    }
+
+    static bool returns_void(ast_type const& result) {
+        auto const* tb = std::get_if<ast_type_basic>(&result);
+        return tb != nullptr && tb->type == type_t::t_void;
+    }
+
+    void function(ast_function const& astfunc) {
+        std::string_view why = result_unsupported(astfunc.return_type);
+        for (auto const& param : astfunc.params) {
+            if (why.empty())
+                why = param_unsupported(param);
+        }
+        if (!why.empty()) {
+            out << "// NOT BOUND: " << astfunc.name << "(), " << why << "\n\n";
+            return;
+        }
+        bool const release_gil = release_gil_functions.find(astfunc.name.spelling) != release_gil_functions.end();
+        out << "static PyObject* p2_fn_" << astfunc.name << "(PyObject*, PyObject* const*" << (astfunc.params.empty() ? "" : " args")
+            << ", Py_ssize_t nargs) {\n"
+            << mpcs::indent
+            << "if (!p2_check_nargs(\"" << astfunc.name << "\", nargs, " << astfunc.params.size() << "))\n"
+            << "    return nullptr;\n";
+        std::vector<std::string> call_args;
+        for (std::size_t i = 0; i < astfunc.params.size(); ++i)
+            call_args.push_back(argument(astfunc.params[i], i));
+        out << "try {\n";
+        {
+            auto body = out.indented();
+            if (release_gil)
+                out << "p2_gil_release nogil;\n";
+            if (!returns_void(astfunc.return_type))
+                out << "auto&& result = ";
+            out << astfunc.name << '(';
+            for (std::size_t i = 0; i < call_args.size(); ++i)
+                out << (i == 0 ? "" : ", ") << call_args[i];
+            out << ");\n";
+            if (release_gil)
+                out << "nogil.restore();\n";
+            if (returns_void(astfunc.return_type))
+                out << "Py_RETURN_NONE;\n";
+            else
+                out << "return " << result_to_python(astfunc.return_type) << ";\n";
+        }
+        out << "} catch (std::exception const& e) {\n"
+            << "    PyErr_SetString(PyExc_RuntimeError, e.what());\n"
+            << "    return nullptr;\n"
+            << "} catch (...) { // nothing may escape into the interpreter\n"
+            << "    PyErr_SetString(PyExc_RuntimeError, \"unidentifiable C++ exception\");\n"
+            << "    return nullptr;\n"
+            << "}\n"
+            << mpcs::unindent
+            << "}\n\n";
+        bound_functions.push_back(astfunc.name);
+    }
+
+    // getter & setter of one struct member, returns false if the member is left out
+    bool member(interned_string struct_name, ast_variable const& var, bool& settable) {
+        interned_string const name = variable_name(var);
+        std::string const self = "p2_self<" + std::string(struct_name.spelling) + ">(self)." + std::string(name.spelling);
+        settable = true;
+        std::string get, set; // the getter's return expression, the setter's body
+        bool const ok = std::visit(overloaded {
+            [&](ast_basic_variable const& bv) {
+                ast_type_basic const& tb = bv.type;
+                if (is_cstring(tb)) { // read only, the struct can't own a python string's buffer
+                    settable = false;
+                    get = "p2_str_from_cstring(" + self + ')';
+                    return true;
+                }
+                if (tb.mod_ptr || tb.mod_ref)
+                    return false;
+                settable = !tb.mod_const;
+                if (known_struct(tb)) {
+                    // a nested struct is a reference into self, `rocket.engine.thrust = 1` changes rocket
+                    get = tb.mod_const ? "p2_wrap_copy(" + self + ")" : "p2_wrap_ref(&" + self + ", self)";
+                    set = std::string(tb.custom_typename.spelling) + "* v = p2_unwrap<" + std::string(tb.custom_typename.spelling) + ">(value);\n"
+                        + "if (v == nullptr)\n    return -1;\n" + self + " = *v;\nreturn 0;\n";
+                    return true;
+                }
+                scalar_converter const* s = scalar_converter_for(tb);
+                if (s == nullptr)
+                    return false;
+                get = std::string(s->to_python) + '(' + self + ')';
+                set = "return " + std::string(s->from_python) + "(value, " + self + ") ? 0 : -1;\n";
+                return true;
+            },
+            [&](ast_container const& con) {
+                if (con.type.mod_ptr || con.type.mod_ref || !container_supported(con.type))
+                    return false;
+                settable = !con.type.mod_const;
+                get = "p2_to_python(" + self + ')';
+                set = value_spelling(con.type) + " v;\nif (!p2_from_python(value, v))\n    return -1;\n" + self + " = std::move(v);\nreturn 0;\n";
+                return true;
+            }
+        }, var);
+        if (!ok) {
+            out << "// NOT BOUND: " << struct_name << "::" << name << ", a pointer, reference or unsupported type\n\n";
+            return false;
+        }
+        out << "static PyObject* p2_get_" << struct_name << '_' << name << "(PyObject* self, void*) {\n"
+            << "    return " << get << ";\n"
+            << "}\n\n";
+        if (settable) {
+            out << "static int p2_set_" << struct_name << '_' << name << "(PyObject* self, PyObject* value, void*) {\n"
+                << mpcs::indent
+                << "if (!p2_check_delete(value))\n"
+                << "    return -1;\n"
+                << set
+                << mpcs::unindent
+                << "}\n\n";
+        }
+        return true;
+    }
+
+    void struct_(ast_struct const& aststruct) {
+        std::vector<std::pair<interned_string, bool>> getset; // member, settable
+        for (auto const& var : aststruct.members) {
+            bool settable;
+            if (member(aststruct.name, var, settable))
+                getset.emplace_back(variable_name(var), settable);
+        }
+        out << "static PyGetSetDef p2_getset_" << aststruct.name << "[] = {\n"
+            << mpcs::indent;
+        for (auto const& [name, settable] : getset) {
+            out << "{ \"" << name << "\", p2_get_" << aststruct.name << '_' << name << ", ";
+            if (settable)
+                out << "p2_set_" << aststruct.name << '_' << name;
+            else
+                out << "nullptr";
+            out << ", nullptr, nullptr },\n";
+        }
+        out << "{ nullptr, nullptr, nullptr, nullptr, nullptr }\n"
+            << mpcs::unindent
+            << "};\n\n"
+            << "static PyType_Slot p2_slots_" << aststruct.name << "[] = {\n"
+            << mpcs::indent
+            << "{ Py_tp_new, reinterpret_cast<void*>(&p2_new<" << aststruct.name << ">) },\n"
+            << "{ Py_tp_dealloc, reinterpret_cast<void*>(&p2_dealloc<" << aststruct.name << ">) },\n"
+            << "{ Py_tp_getset, p2_getset_" << aststruct.name << " },\n"
+            << "{ 0, nullptr }\n"
+            << mpcs::unindent
+            << "};\n\n"
+            << "static PyType_Spec p2_spec_" << aststruct.name << " = {\n"
+            << "    \"" << module << '.' << aststruct.name << "\", static_cast<int>(sizeof(p2_instance<" << aststruct.name
+            << ">)), 0, Py_TPFLAGS_DEFAULT, p2_slots_" << aststruct.name << "\n"
+            << "};\n\n";
+    }
+
+    void module_init() {
+        out << "static PyMethodDef p2_methods[] = {\n"
+            << mpcs::indent;
+        for (interned_string name : bound_functions) {
+            out << "{ \"" << name << "\", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(&p2_fn_" << name
+                << ")), METH_FASTCALL, nullptr },\n";
+        }
+        out << "{ nullptr, nullptr, 0, nullptr }\n"
+            << mpcs::unindent
+            << "};\n\n"
+            << "static PyModuleDef p2_module = { PyModuleDef_HEAD_INIT, \"" << module << "\", nullptr, -1, p2_methods, nullptr, nullptr, nullptr, nullptr };\n\n"
+            << "}\n\n"
+            << "PyMODINIT_FUNC PyInit_" << module << "() {\n"
+            << mpcs::indent
+            << "using namespace " << module << "_capi;\n\n"
+            << "PyObject* module = PyModule_Create(&p2_module);\n"
+            << "if (module == nullptr)\n"
+            << "    return nullptr;\n";
+        for (ast_struct const* aststruct : struct_order) {
+            out << "if (!p2_add_class<" << aststruct->name << ">(module, &p2_spec_" << aststruct->name << ", \"" << aststruct->name << "\")) {\n"
+                << "    Py_DECREF(module);\n"
+                << "    return nullptr;\n"
+                << "}\n";
+        }
+        out << "return module;\n"
+            << mpcs::unindent
+            << "}\n";
+    }
+
+    mpcs::IndentStream&                                out;
+    std::string_view                                   module;
+    std::unique_ptr<ast> const&                        my_ast;
+    std::set<std::string, std::less<>> const&          release_gil_functions;
+    std::unordered_map<string_id, ast_struct const*>   structs;      // the structs defined in this header, by name
+    std::vector<ast_struct const*>                     struct_order; // first definition of each, in header order
+    std::vector<interned_string>                       bound_functions;
+
+public:
+    capi_generator(mpcs::IndentStream& _out, std::string_view _module, std::unique_ptr<ast> const& _my_ast,
+                   std::set<std::string, std::less<>> const& _release_gil) :
+        out(_out), module(_module), my_ast(_my_ast), release_gil_functions(_release_gil),
+        structs(), struct_order(), bound_functions() {}
+
+    void generate() {
+        for (auto const& node : *my_ast) {
+            if (auto const* aststruct = std::get_if<ast_struct>(&node); aststruct && structs.try_emplace(aststruct->name.id, aststruct).second)
+                struct_order.push_back(aststruct);
+        }
+        out << fastcall_support
+            << capi_runtime_support
+            << "// the module's own definitions, kept apart from other modules' in a unity build\n"
+            << "namespace " << module << "_capi {\n\n";
+        for (ast_struct const* aststruct : struct_order)
+            struct_(*aststruct);
+        std::unordered_set<string_id> functions_seen; // no overloading, the first declaration wins
+        for (auto const& node : *my_ast) {
+            if (auto const* astfunc = std::get_if<ast_function>(&node); astfunc && functions_seen.insert(astfunc->name.id).second)
+                function(*astfunc);
+        }
+        module_init();
+    }
+};
+
+}
+#endif
@@ -4,22 +4,30 @@
 #include <algorithm>
 #include <boost/algorithm/string/replace.hpp>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
 #include <iterator>
-#include <map>
 #include <memory>
 #include <set>
+#include <sstream>
 #include <string>
 #include <string_view>
-#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <variant>
+#include <vector>
+#include "capigen.h"
 #include "ctre.hpp"
+#include "executor.h"
 #include "indentstream.h"
+#include "outputfile.h"
 #include "parsefile.h"
+#include "stringpool.h"
 
 namespace proj2 {
 
+// Part of the output cache key, bump it whenever a change to the generators changes what they emit
+inline constexpr std::string_view generator_version = "proj2-codegen-3";
+
 // Static reflection would be nice...
 constexpr char const* to_string(container_t ct) {
     switch (ct) {
@@ -71,8 +79,624 @@ struct headerfile {
     std::string      const cppfile;
     std::string      const pyfile;
     std::string_view const modulename;
+
+    // foo.h -> foo_part<k>.cpp, see codegen_options::shards
+    std::string shard_cppfile(std::size_t k) const {
+        std::filesystem::path shard(cppfile);
+        shard.replace_extension();
+        shard += "_part" + std::to_string(k) + ".cpp";
+        return shard.string();
+    }
+};
+
+// what the generated .cpp binds with, see --backend
+enum class codegen_backend { boostpython, capi };
+
+constexpr char const* to_string(codegen_backend backend) {
+    switch (backend) {
+        case codegen_backend::boostpython : return "boostpython";
+        case codegen_backend::capi        : return "capi"       ;
+        default                           : return "unknown"    ;
+    };
+}
+
+// Options that change what is generated, so they are also part of the output cache key
+struct codegen_options {
+    // capi: the module uses the CPython C API directly and builds without boost, see capigen.h.
+    // Sharding, the buffer protocol, operator== & std::hash only apply to the boost python backend
+    codegen_backend backend = codegen_backend::boostpython;
+    // 0: everything in one .cpp. N: the BOOST_PYTHON_MODULE registrations are split over N foo_part<k>.cpp
+    // files, each defining register_part_k(), and foo.cpp's module body just calls them
+    std::size_t shards = 0;
+    // std::vector<arithmetic> classes also get the python buffer protocol, memoryview(v) & numpy.asarray(v) don't copy,
+    // and any contiguous buffer of a matching type (array.array, bytes, ndarray) converts to such a vector with one copy
+    bool buffer_protocol = false;
+    // functions whose def() releases the GIL for the duration of the c++ call, see --release-gil
+    std::set<std::string, std::less<>> release_gil;
+    // the structs that get a member-wise operator== also get a std::hash specialization
+    bool std_hash = false;
+    // builtin scalar members of each struct are typed getset descriptors instead of def_readwrite properties,
+    // and instances have no __dict__, see --slots
+    bool slots = false;
+    // functions are registered as METH_FASTCALL wrappers converting builtin arguments & results inline,
+    // only custom types & containers go through the boost python converter registry, see --fast-calls
+    bool fast_calls = false;
+    // the structs, & the vector & map classes of them, get a pickle_suite with a compact binary state, see --pickle
+    bool pickle = false;
+
+    bool releases_gil(std::string_view function) const { return release_gil.find(function) != release_gil.end(); }
+
+    std::string fingerprint() const {
+        std::string fp = std::string("backend=") + to_string(backend) + ";shards=" + std::to_string(shards) + ";buffer_protocol=" + std::to_string(buffer_protocol)
+                       + ";std_hash=" + std::to_string(std_hash) + ";fast_calls=" + std::to_string(fast_calls) + ";slots=" + std::to_string(slots)
+                       + ";pickle=" + std::to_string(pickle) + ";release_gil=";
+        for (std::string const& function : release_gil)
+            fp += function + ',';
+        return fp;
+    }
+};
+
+// struct module format character of a plain arithmetic value, 0 if it can't be exposed as a buffer
+constexpr char buffer_format(ast_type_basic const& element) {
+    if (element.mod_const || element.mod_ptr || element.mod_ref)
+        return 0;
+    switch (element.type) {
+        case type_t::t_char              : return element.mod_unsigned ? 'B' : 'c';
+        case type_t::t_short             : return element.mod_unsigned ? 'H' : 'h';
+        case type_t::t_int               : return element.mod_unsigned ? 'I' : 'i';
+        case type_t::t_long              : return element.mod_unsigned ? 'L' : 'l';
+        case type_t::t_float             : return 'f';
+        case type_t::t_double            : return 'd';
+        default                          : return 0;
+    };
+}
+
+// struct module format character of a std::vector's elements, 0 if its elements can't be exposed as a buffer
+constexpr char buffer_format(ast_type_container const& container) {
+    if (container.type != container_t::c_vector || container.template_types.size() != 1)
+        return 0;
+    return buffer_format(container.template_types.front());
+}
+
+// Defined once per generated .cpp that registers a function with --release-gil, guarded for unity builds
+constexpr char const* gil_release_support = R"c++(#ifndef P2_GIL_RELEASE
+#  define P2_GIL_RELEASE
+// RELEASES THE GIL AROUND THE C++ CALL, other python threads run meanwhile
+// Note: boost python converts the arguments before and the result after the call, both with the GIL held,
+// the function itself must not touch python objects
+struct p2_gil_release {
+    PyThreadState* state;
+    p2_gil_release() : state(PyEval_SaveThread()) {}
+    ~p2_gil_release() { PyEval_RestoreThread(state); }
+    p2_gil_release(p2_gil_release const&) = delete;
+    p2_gil_release& operator=(p2_gil_release const&) = delete;
+};
+
+template <auto Function, typename R, typename... Args>
+R p2_call_without_gil(Args... args) {
+    p2_gil_release nogil;
+    return Function(std::forward<Args>(args)...);
+}
+
+template <auto Function, typename R, typename... Args>
+constexpr auto p2_without_gil(R (*)(Args...)) {
+    return &p2_call_without_gil<Function, R, Args...>;
+}
+
+template <auto Function>
+constexpr auto p2_without_gil() {
+    return p2_without_gil<Function>(Function);
+}
+#endif
+
+)c++";
+
+// Defined once per generated .cpp that registers a buffer, guarded for unity builds
+constexpr char const* buffer_protocol_support = R"c++(#ifndef P2_BUFFER_PROTOCOL
+#  define P2_BUFFER_PROTOCOL
+// ZERO-COPY PYTHON BUFFER PROTOCOL FOR std::vector, e.g. memoryview(v) or numpy.asarray(v)
+// Note: a view points into the vector, don't resize the vector while a view of it is alive
+template <typename Vector, char Format>
+struct p2_vector_buffer {
+    static constexpr char format[] = { Format, '\0' };
+
+    static int get(PyObject* self, Py_buffer* view, int flags) {
+        boost::python::extract<Vector&> vec(self);
+        if (!vec.check()) {
+            view->obj = nullptr;
+            PyErr_SetString(PyExc_BufferError, "not a wrapped std::vector");
+            return -1;
+        }
+        // shape & stride, owned by the exporter until release(), consumers may copy the Py_buffer
+        Py_ssize_t* shape = new Py_ssize_t[2]{ static_cast<Py_ssize_t>(vec().size()), static_cast<Py_ssize_t>(sizeof(typename Vector::value_type)) };
+        Py_INCREF(self);
+        view->obj        = self;
+        view->buf        = vec().data();
+        view->len        = shape[0] * static_cast<Py_ssize_t>(sizeof(typename Vector::value_type));
+        view->readonly   = 0;
+        view->itemsize   = sizeof(typename Vector::value_type);
+        view->format     = (flags & PyBUF_FORMAT) ? const_cast<char*>(format) : nullptr;
+        view->ndim       = 1;
+        view->shape      = (flags & PyBUF_ND) ? shape : nullptr;
+        view->strides    = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? shape + 1 : nullptr;
+        view->suboffsets = nullptr;
+        view->internal   = shape;
+        return 0;
+    }
+
+    static void release(PyObject*, Py_buffer* view) {
+        delete[] static_cast<Py_ssize_t*>(view->internal);
+    }
+};
+
+// Rvalue converter, lets by value & const& vector parameters take any contiguous buffer of the same element type.
+// A wrapped vector still binds directly (class converters are tried first), only foreign buffers are copied, in one go.
+template <typename Vector, char Format>
+struct p2_vector_from_buffer {
+    using value_type = typename Vector::value_type;
+
+    // array.array, bytes, numpy etc. spell the same element type differently, so compare kind & size
+    static char kind(char format) {
+        switch (format) {
+            case 'f': case 'd':                               return 'f';
+            case 'b': case 'h': case 'i': case 'l': case 'q': return 'i';
+            case 'B': case 'H': case 'I': case 'L': case 'Q': return 'u';
+            case 'c':                                         return 'c';
+            default :                                         return 0;
+        }
+    }
+
+    static bool matches(Py_buffer const& view) {
+        char const* format = view.format ? view.format : "B";
+        if (*format == '@' || *format == '=')
+            ++format;
+        if (format[0] == '\0' || format[1] != '\0' || view.ndim != 1 || view.itemsize != sizeof(value_type))
+            return false;
+        char const have = kind(format[0]), want = kind(Format);
+        bool const bytes = sizeof(value_type) == 1 && have != 'f' && want != 'f'; // char, signed & unsigned bytes mix freely
+        return have != 0 && (have == want || bytes);
+    }
+
+    static void* convertible(PyObject* obj) {
+        if (!PyObject_CheckBuffer(obj))
+            return nullptr;
+        Py_buffer view;
+        if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+            PyErr_Clear();
+            return nullptr;
+        }
+        bool const ok = matches(view);
+        PyBuffer_Release(&view);
+        return ok ? obj : nullptr;
+    }
+
+    static void construct(PyObject* obj, boost::python::converter::rvalue_from_python_stage1_data* data) {
+        void* storage = reinterpret_cast<boost::python::converter::rvalue_from_python_storage<Vector>*>(data)->storage.bytes;
+        Py_buffer view;
+        if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+            boost::python::throw_error_already_set();
+        value_type const* first = static_cast<value_type const*>(view.buf);
+        new (storage) Vector(first, first + view.len / static_cast<Py_ssize_t>(sizeof(value_type)));
+        PyBuffer_Release(&view);
+        data->convertible = storage;
+    }
+};
+
+template <typename Vector, char Format>
+void p2_enable_buffer_protocol() {
+    static PyBufferProcs procs = { &p2_vector_buffer<Vector, Format>::get, &p2_vector_buffer<Vector, Format>::release };
+    auto const* registration = boost::python::converter::registry::query(boost::python::type_id<Vector>());
+    reinterpret_cast<PyTypeObject*>(registration->get_class_object())->tp_as_buffer = &procs;
+    boost::python::converter::registry::push_back(
+        &p2_vector_from_buffer<Vector, Format>::convertible,
+        &p2_vector_from_buffer<Vector, Format>::construct,
+        boost::python::type_id<Vector>());
+}
+#endif
+
+)c++";
+
+// Defined once per generated .cpp with --fast-calls, after fastcall_support, guarded for unity builds
+constexpr char const* boost_fastcall_support = R"c++(#ifndef P2_BOOST_FASTCALL
+#  define P2_BOOST_FASTCALL
+// REGISTERS A METH_FASTCALL FUNCTION IN THE CURRENT SCOPE, bypassing boost python's overload dispatch
+inline void p2_def_fastcall(char const* name, PyObject* (*function)(PyObject*, PyObject* const*, Py_ssize_t)) {
+    // the method table entry has to outlive the function object, i.e. the module
+    auto* def = new PyMethodDef{ name, reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(function)), METH_FASTCALL, nullptr };
+    boost::python::scope module;
+    boost::python::object module_name = module.attr("__name__");
+    module.attr(name) = boost::python::object(boost::python::handle<>(PyCFunction_NewEx(def, nullptr, module_name.ptr())));
+}
+
+inline PyObject* p2_argument_error(char const* function, int index, PyObject* arg) {
+    PyErr_Format(PyExc_TypeError, "%s() argument %d has an unsupported type: %s", function, index + 1, Py_TYPE(arg)->tp_name);
+    return nullptr;
+}
+#endif
+
+)c++";
+
+// Defined once per generated .cpp with --slots, after fastcall_support, guarded for unity builds
+constexpr char const* slots_support = R"c++(#ifndef P2_SLOTS
+#  define P2_SLOTS
+// TYPED ATTRIBUTE ACCESS FOR WRAPPED STRUCTS, a getset descriptor per scalar member
+template <typename Struct>
+Struct* p2_instance_of(PyObject* self) {
+    void* found = boost::python::objects::find_instance_impl(self, boost::python::type_id<Struct>());
+    if (found == nullptr)
+        PyErr_Format(PyExc_TypeError, "%s is not a wrapped %s", Py_TYPE(self)->tp_name, boost::python::type_id<Struct>().name());
+    return static_cast<Struct*>(found);
+}
+
+// Note: the member pointer is a template argument, so each accessor compiles down to a fixed offset into the struct
+template <typename Struct, auto Member, auto ToPython, auto FromPython>
+struct p2_member {
+    static PyObject* get(PyObject* self, void*) {
+        Struct* object = p2_instance_of<Struct>(self);
+        return object ? ToPython(object->*Member) : nullptr;
+    }
+
+    static int set(PyObject* self, PyObject* value, void*) {
+        if (value == nullptr) {
+            PyErr_SetString(PyExc_AttributeError, "can't delete attribute");
+            return -1;
+        }
+        Struct* object = p2_instance_of<Struct>(self);
+        return object && FromPython(value, object->*Member) ? 0 : -1;
+    }
+
+    static PyGetSetDef def(char const* name) {
+        return { name, &get, &set, nullptr, nullptr };
+    }
+};
+
+// Installs the descriptors on a class_ & drops the instance __dict__, like __slots__ no other attributes can be set.
+// Note: the class can't be subclassed in python any more, a subclass would put its __dict__ where boost keeps the c++ object
+inline void p2_slots(boost::python::object const& cls, PyGetSetDef* members) {
+    auto* type = reinterpret_cast<PyTypeObject*>(cls.ptr());
+    for (PyGetSetDef* member = members; member->name != nullptr; ++member) {
+        boost::python::handle<> descriptor(PyDescr_NewGetSet(type, member));
+        if (PyObject_SetAttrString(cls.ptr(), member->name, descriptor.get()) != 0)
+            boost::python::throw_error_already_set();
+    }
+    type->tp_dictoffset = 0;
+    type->tp_flags &= ~Py_TPFLAGS_BASETYPE;
+    PyType_Modified(type);
+}
+#endif
+
+)c++";
+
+// Defined once per generated .cpp with --pickle, guarded for unity builds
+constexpr char const* pickle_support = R"c++(#ifndef P2_PICKLE
+#  define P2_PICKLE
+// COMPACT BINARY PICKLING, arithmetic fields are copied as is, strings, vectors & maps are a varint count then their contents
+// Note: the layout is the native one (type sizes & byte order), meant for passing objects between processes on one machine
+struct p2_pickle_writer {
+    std::string bytes;
+
+    void raw(void const* data, std::size_t size) {
+        bytes.append(static_cast<char const*>(data), size);
+    }
+
+    void count(std::size_t n) {
+        do {
+            char byte = static_cast<char>(n & 0x7f);
+            n >>= 7;
+            bytes.push_back(n != 0 ? static_cast<char>(byte | 0x80) : byte);
+        } while (n != 0);
+    }
+};
+
+// ok turns false once the state runs out or a count doesn't fit in what is left
+struct p2_pickle_reader {
+    char const* pos;
+    char const* end;
+    bool        ok;
+
+    std::size_t left() const { return static_cast<std::size_t>(end - pos); }
+
+    void raw(void* data, std::size_t size) {
+        if (left() < size) {
+            ok  = false;
+            pos = end;
+            return;
+        }
+        std::memcpy(data, pos, size);
+        pos += size;
+    }
+
+    std::size_t count() {
+        std::size_t n = 0;
+        for (unsigned shift = 0; pos != end && shift < 64; shift += 7) {
+            unsigned char const byte = static_cast<unsigned char>(*pos++);
+            n |= static_cast<std::size_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return n;
+        }
+        ok = false;
+        return 0;
+    }
+};
+
+template <typename T>
+constexpr bool p2_packed_as_is = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
+template <typename T>
+std::enable_if_t<p2_packed_as_is<T>> p2_pack(p2_pickle_writer& out, T value) {
+    out.raw(&value, sizeof value);
+}
+
+template <typename T>
+std::enable_if_t<p2_packed_as_is<T>> p2_unpack(p2_pickle_reader& in, T& value) {
+    in.raw(&value, sizeof value);
+}
+
+inline void p2_pack(p2_pickle_writer& out, std::string const& value) {
+    out.count(value.size());
+    out.raw(value.data(), value.size());
+}
+
+inline void p2_unpack(p2_pickle_reader& in, std::string& value) {
+    std::size_t const n = in.count();
+    if (n > in.left()) {
+        in.ok = false;
+        return;
+    }
+    value.assign(in.pos, n);
+    in.pos += n;
+}
+
+// Note: the structs' own p2_pack/p2_unpack are generated per module & found by ADL
+template <typename T, typename Alloc>
+void p2_pack(p2_pickle_writer& out, std::vector<T, Alloc> const& value) {
+    out.count(value.size());
+    if constexpr (p2_packed_as_is<T>)
+        out.raw(value.data(), value.size() * sizeof(T)); // one run, no per element work
+    else {
+        for (T const& element : value)
+            p2_pack(out, element);
+    }
+}
+
+template <typename T, typename Alloc>
+void p2_unpack(p2_pickle_reader& in, std::vector<T, Alloc>& value) {
+    std::size_t const n = in.count();
+    value.clear();
+    if constexpr (p2_packed_as_is<T>) {
+        if (n > in.left() / sizeof(T)) {
+            in.ok = false;
+            return;
+        }
+        value.resize(n);
+        in.raw(value.data(), n * sizeof(T));
+    } else {
+        value.reserve(std::min(n, in.left()));
+        for (std::size_t i = 0; i < n && in.ok; ++i) {
+            value.emplace_back();
+            p2_unpack(in, value.back());
+        }
+    }
+}
+
+template <typename Key, typename T, typename Compare, typename Alloc>
+void p2_pack(p2_pickle_writer& out, std::map<Key, T, Compare, Alloc> const& value) {
+    out.count(value.size());
+    for (auto const& [key, mapped] : value) {
+        p2_pack(out, key);
+        p2_pack(out, mapped);
+    }
+}
+
+template <typename Key, typename T, typename Compare, typename Alloc>
+void p2_unpack(p2_pickle_reader& in, std::map<Key, T, Compare, Alloc>& value) {
+    std::size_t const n = in.count();
+    value.clear();
+    for (std::size_t i = 0; i < n && in.ok; ++i) {
+        Key key{};
+        T   mapped{};
+        p2_unpack(in, key);
+        p2_unpack(in, mapped);
+        value.emplace_hint(value.end(), std::move(key), std::move(mapped)); // packed in order, so always at the end
+    }
+}
+
+// def_pickle(p2_pickle_suite<T>()), the state is one bytes object & the instance is default constructed before __setstate__
+template <typename T>
+struct p2_pickle_suite : boost::python::pickle_suite {
+    static boost::python::object getstate(T const& value) {
+        p2_pickle_writer out;
+        p2_pack(out, value);
+        return boost::python::object(boost::python::handle<>(
+            PyBytes_FromStringAndSize(out.bytes.data(), static_cast<Py_ssize_t>(out.bytes.size()))));
+    }
+
+    static void setstate(T& value, boost::python::object state) {
+        char*      data;
+        Py_ssize_t size;
+        if (PyBytes_AsStringAndSize(state.ptr(), &data, &size) != 0)
+            boost::python::throw_error_already_set();
+        p2_pickle_reader in{ data, data + size, true };
+        T unpacked{}; // a bad state leaves the instance as it was
+        p2_unpack(in, unpacked);
+        if (!in.ok || in.pos != in.end) {
+            PyErr_Format(PyExc_ValueError, "%s: malformed pickle state (%zd bytes)", boost::python::type_id<T>().name(), size);
+            boost::python::throw_error_already_set();
+        }
+        value = std::move(unpacked);
+    }
+};
+#endif
+
+)c++";
+
+// c++ spelling of a type as declared, e.g. "unsigned int const&"
+inline std::string spelling(ast_type_basic const& tb) {
+    std::string s = tb.mod_unsigned ? "unsigned " : "";
+    if (tb.type == type_t::t_custom)
+        s += tb.custom_typename.spelling;
+    else
+        s += to_string(tb.type);
+    if (tb.mod_const)
+        s += " const";
+    if (tb.mod_ptr)
+        s += '*';
+    if (tb.mod_ref)
+        s += '&';
+    return s;
+}
+
+inline std::string spelling(ast_type_container const& tc) {
+    std::string s = to_string(tc.type);
+    s += '<';
+    for (auto tb = tc.template_types.cbegin(); tb != tc.template_types.cend(); tb++) {
+        if (tb != tc.template_types.cbegin())
+            s += ", ";
+        s += spelling(*tb);
+    }
+    s += '>';
+    if (tc.mod_const)
+        s += " const";
+    if (tc.mod_ptr)
+        s += '*';
+    if (tc.mod_ref)
+        s += '&';
+    return s;
+}
+
+// a container as its indexing suite class_<> is declared, e.g. "std::vector<unsigned int >",
+// the python class name is mangle_name() of it. Note: the container's own modifiers aren't part of it
+inline std::string registered_name(ast_type_container const& tc) {
+    std::string s = to_string(tc.type);
+    s += '<';
+    for (auto tb = tc.template_types.cbegin(); tb != tc.template_types.cend(); tb++) {
+        if (tb != tc.template_types.cbegin())
+            s += ", ";
+        if (tb->mod_unsigned)
+            s += "unsigned ";
+        if (tb->type == type_t::t_custom)
+            s += tb->custom_typename.spelling;
+        else
+            s += to_string(tb->type);
+        s += ' ';
+        if (tb->mod_const)
+            s += "const ";
+        if (tb->mod_ptr)
+            s += "* ";
+        if (tb->mod_ref)
+            s += "& ";
+    }
+    s += '>';
+    return s;
+}
+
+// Defined once per generated .cpp that registers a column accessor, after buffer_protocol_support, guarded for unity builds
+constexpr char const* column_support = R"c++(#ifndef P2_COLUMNS
+#  define P2_COLUMNS
+// STRIDED ZERO-COPY VIEW OF ONE FIELD ACROSS A std::vector OF STRUCTS, e.g. rockets.column("max_speed")
+// Note: like the vector buffers, don't resize the vector while a view of it is alive.
+// Each module gets its own p2_column type object, an inline one would be shared by every module loaded in the process
+namespace {
+
+struct p2_column {
+    PyObject_HEAD
+    PyObject*  owner; // the wrapped vector, kept alive by the view
+    char*      buf;
+    Py_ssize_t shape;
+    Py_ssize_t stride;
+    Py_ssize_t itemsize;
+    char       format[2];
+
+    static int get(PyObject* obj, Py_buffer* view, int flags) {
+        auto* self = reinterpret_cast<p2_column*>(obj);
+        if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && self->stride != self->itemsize) {
+            view->obj = nullptr;
+            PyErr_SetString(PyExc_BufferError, "a column is strided");
+            return -1;
+        }
+        Py_INCREF(obj);
+        view->obj        = obj;
+        view->buf        = self->buf;
+        view->len        = self->shape * self->itemsize;
+        view->readonly   = 0;
+        view->itemsize   = self->itemsize;
+        view->format     = (flags & PyBUF_FORMAT) ? self->format : nullptr;
+        view->ndim       = 1;
+        view->shape      = (flags & PyBUF_ND) ? &self->shape : nullptr;
+        view->strides    = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &self->stride : nullptr;
+        view->suboffsets = nullptr;
+        view->internal   = nullptr;
+        return 0;
+    }
+
+    static void dealloc(PyObject* obj) {
+        Py_XDECREF(reinterpret_cast<p2_column*>(obj)->owner);
+        PyObject_Del(obj);
+    }
+
+    static PyTypeObject* type() {
+        static PyBufferProcs procs = { &p2_column::get, nullptr };
+        static PyTypeObject column_type = { PyVarObject_HEAD_INIT(nullptr, 0) };
+        if (column_type.tp_name == nullptr) {
+            column_type.tp_name      = "p2_column";
+            column_type.tp_basicsize = sizeof(p2_column);
+            column_type.tp_flags     = Py_TPFLAGS_DEFAULT;
+            column_type.tp_dealloc   = &p2_column::dealloc;
+            column_type.tp_as_buffer = &procs;
+            if (PyType_Ready(&column_type) != 0)
+                boost::python::throw_error_already_set();
+        }
+        return &column_type;
+    }
+};
+
+template <typename Member>
+struct p2_member_traits;
+
+template <typename Struct, typename Field>
+struct p2_member_traits<Field Struct::*> {
+    using struct_type = Struct;
+    using field_type  = Field;
 };
 
+template <auto Member>
+boost::python::object p2_vector_column(boost::python::object self, char format) {
+    using traits = p2_member_traits<decltype(Member)>;
+    static char empty;
+    auto& vec = boost::python::extract<std::vector<typename traits::struct_type>&>(self)();
+    p2_column* column = PyObject_New(p2_column, p2_column::type());
+    if (column == nullptr)
+        boost::python::throw_error_already_set();
+    column->owner    = boost::python::incref(self.ptr());
+    column->buf      = vec.empty() ? &empty : reinterpret_cast<char*>(&(vec.data()->*Member));
+    column->shape    = static_cast<Py_ssize_t>(vec.size());
+    column->stride   = static_cast<Py_ssize_t>(sizeof(typename traits::struct_type));
+    column->itemsize = static_cast<Py_ssize_t>(sizeof(typename traits::field_type));
+    column->format[0] = format;
+    column->format[1] = '\0';
+    boost::python::handle<> exporter(reinterpret_cast<PyObject*>(column));
+    return boost::python::object(boost::python::handle<>(PyMemoryView_FromObject(exporter.get())));
+}
+
+inline boost::python::object p2_no_column(std::string const& name, char const* columns) {
+    PyErr_Format(PyExc_KeyError, "no column '%s', the arithmetic members are: %s", name.c_str(), columns);
+    boost::python::throw_error_already_set();
+    return {};
+}
+
+}
+#endif
+
+)c++";
+
+// every file cpptopy() writes for hfile
+inline std::vector<std::string> generated_files(headerfile const& hfile, codegen_options const& options) {
+    std::vector<std::string> files{ hfile.cppfile, hfile.pyfile };
+    for (std::size_t k = 0; k < options.shards; ++k)
+        files.push_back(hfile.shard_cppfile(k));
+    return files;
+}
+
 constexpr auto mangle_stl_container_regex
     = ctll::fixed_string{"^(?:std::)?([a-zA-Z_]+\\w*)\\s*<(?:std::)?([\\w \\*&_]+),? (?:std::)?([\\w \\*&_]+)*>$"};
 // there is a problem with clashing mangled names if for some reason you name your struct "string"
@@ -109,7 +733,8 @@ inline std::string mangle_name(std::string_view name) {
 }
 
 class code_generator_base {
-    std::ofstream ofs;
+    std::string        path;
+    std::ostringstream rendered; // the whole file, only written out by write_output() if it changed
 protected:
     mpcs::IndentStream ifs;
     headerfile const& sourcefile;
@@ -118,10 +743,10 @@ protected:
     state my_state;
 
     code_generator_base(
-        std::string const& path,
+        std::string const& _path,
         headerfile const& _sourcefile,
         std::unique_ptr<ast> const& _my_ast)
-        : ofs(path), ifs(ofs), sourcefile(_sourcefile), my_ast(_my_ast), my_state(state::none) {}
+        : path(_path), rendered(), ifs(rendered), sourcefile(_sourcefile), my_ast(_my_ast), my_state(state::none) {}
 
     bool generating_code()           const { return my_state != state::none; }
     bool generating_headers()        const { return my_state == state::header; }
@@ -130,6 +755,13 @@ protected:
     bool generating_code_finished()  const { return my_state == state::done; }
 
     virtual ~code_generator_base() = default;
+
+public:
+    // returns false if the file on disk was already up to date
+    bool write_output() {
+        ifs.flush();
+        return write_if_changed(path, rendered.str());
+    }
 };
 
 class cplusplus_generator : code_generator_base {
@@ -147,7 +779,7 @@ struct cppfile_ast_visitor : ast_visitor_base {
 };
 
     void boostpython_start() {
-        ifs << "BOOST_PYTHON_MODULE("
+        boostpython << "BOOST_PYTHON_MODULE("
             << sourcefile.modulename
             << "){\n"
             << mpcs::indent
@@ -155,33 +787,81 @@ struct cppfile_ast_visitor : ast_visitor_base {
     }
 
     void boostpython_end() {
-        ifs << mpcs::unindent
+        boostpython << mpcs::unindent
             << "}\n";
     }
 
-    void boostpython_indexing_suite(std::string_view container_name, std::string_view container_mangled_name, container_t c_type) {
-        ifs << "class_<"
+    // the members of element_struct a column view can cover, see --buffer-protocol
+    std::vector<std::pair<interned_string, char>> columns(string_id element_struct) const {
+        std::vector<std::pair<interned_string, char>> found;
+        auto const it = structs.find(element_struct);
+        if (it == structs.end())
+            return found;
+        for (auto const& member : it->second->members) {
+            if (auto const* bv = std::get_if<ast_basic_variable>(&member); bv && buffer_format(bv->type) != 0)
+                found.emplace_back(bv->name, buffer_format(bv->type));
+        }
+        return found;
+    }
+
+    void boostpython_column(std::string_view element_struct, std::vector<std::pair<interned_string, char>> const& members) {
+        boostpython << ".def(\"column\", +[](object self, std::string const& name) -> object {\n"
+            << mpcs::indent;
+        std::string names;
+        for (auto const& [member, format] : members) {
+            boostpython << "if (name == \"" << member << "\")\n"
+                << "    return p2_vector_column<&" << element_struct << "::" << member << ">(self, '" << format << "');\n";
+            names += names.empty() ? "" : ", ";
+            names += member.spelling;
+        }
+        boostpython << "return p2_no_column(name, \"" << names << "\");\n"
+            << mpcs::unindent
+            << "})";
+    }
+
+    void boostpython_indexing_suite(std::string_view container_name, std::string_view container_mangled_name, container_t c_type, char format, string_id element_struct, bool pickle) {
+        auto const column_members = columns(element_struct);
+        boostpython << "class_<"
             << container_name
             << ">(\""
             << container_mangled_name
-            << "\")\n"
-            << mpcs::indent
-            << ".def(";
-        if (c_type == container_t::c_map)
-            ifs << "map_indexing_suite";
-        else if (c_type == container_t::c_vector)
-            ifs << "vector_indexing_suite";
-        ifs << '<'
-            << container_name
-            << ">());\n\n"
-            << mpcs::unindent;
+            << "\")\n";
+        {
+            auto def = boostpython.indented();
+            boostpython << ".def(";
+            if (c_type == container_t::c_map)
+                boostpython << "map_indexing_suite";
+            else if (c_type == container_t::c_vector)
+                boostpython << "vector_indexing_suite";
+            boostpython << '<'
+                << container_name
+                << ">())";
+            if (!column_members.empty()) {
+                boostpython << '\n';
+                boostpython_column(symbols[element_struct], column_members);
+            }
+            if (pickle) {
+                boostpython << "\n.def_pickle(p2_pickle_suite<"
+                    << container_name
+                    << ">())";
+            }
+            boostpython << ";\n";
+        }
+        if (format != 0) {
+            boostpython << "p2_enable_buffer_protocol<"
+                << container_name
+                << ", '"
+                << format
+                << "'>();\n";
+        }
+        boostpython << '\n';
     }
 
     void basic_variable(ast_basic_variable const& astbv) {
         if (!current_function.empty())
             type_basic(astbv.type);
         else if (!current_struct.empty()) {
-            ifs << "\n.def_readwrite(\""
+            boostpython << "\n.def_readwrite(\""
                 << astbv.name
                 << "\", &"
                 << current_struct
@@ -190,14 +870,14 @@ struct cppfile_ast_visitor : ast_visitor_base {
                 << ")";
         }
         if (generating_stubs())
-            ifs << astbv.name; 
+            stubs << astbv.name;
     }
 
     void container(ast_container const& astcon) {
         if (!current_function.empty())
             type_container(astcon.type);
         else if (!current_struct.empty()) {
-            ifs << "\n.def_readwrite(\""
+            boostpython << "\n.def_readwrite(\""
                 << astcon.name
                 << "\", &"
                 << current_struct
@@ -206,7 +886,7 @@ struct cppfile_ast_visitor : ast_visitor_base {
                 << ")";
         }
         if (generating_stubs())
-            ifs << astcon.name;
+            stubs << astcon.name;
     }
 
     void function(ast_function const& astfunc) {
@@ -217,81 +897,514 @@ struct cppfile_ast_visitor : ast_visitor_base {
                 variable(astvar);
             }
         } else if (generating_stubs()) {
-            // Note: there is a bug here where indexing_suite code is not generated for containers that are part of a function with a definition
-            // fixing this would involve decoupling current_container & ifs << code generation
-            // because the following code is called only a function has no definition, _add_container_to_indexing_suite() is never called when it should be
-            if (astfunc.declaration_only) {
+            // Note: a function with a definition gets no stub, its types are still visited with the stubs stream
+            // switched off so the containers it uses get their indexing suites
+            if (!astfunc.declaration_only) {
+                stubs.setstate(std::ios::badbit);
+                type(astfunc.return_type);
+                for (auto const& astvar : astfunc.params)
+                    variable(astvar);
+                stubs.clear();
+            } else {
                 type(astfunc.return_type);
-                ifs << astfunc.name << '(';
+                stubs << astfunc.name << '(';
 
                 for (auto astvar = astfunc.params.cbegin(); astvar != astfunc.params.cend(); astvar++) {
                     variable(*astvar);
                     if (std::next(astvar) != astfunc.params.cend())
-                        ifs << ", "; // ostream_joiner would be nice here...
+                        stubs << ", "; // ostream_joiner would be nice here...
                 }
-                ifs << ") {\n"
+                stubs << ") {\n"
                     << mpcs::indent
                     << "// FUNCTION IMPLEMENTATION\n"
                     << mpcs::unindent
                     << "}\n\n";
             }
         } else if (generating_boostpython()) {
-            ifs << "def(\""
+            if (options.fast_calls && !options.releases_gil(astfunc.name) && fastcall_supported(astfunc)) {
+                fastcall(astfunc);
+                fastcall_required = true;
+                current_function = "";
+                return;
+            }
+            boostpython << "def(\""
                 << astfunc.name
-                << "\", "
-                << astfunc.name;
+                << "\", ";
+            if (options.releases_gil(astfunc.name)) {
+                boostpython << "p2_without_gil<"
+                    << astfunc.name
+                    << ">()";
+                gil_release_required = true;
+            } else
+                boostpython << astfunc.name;
             type(astfunc.return_type);
-            ifs << ");\n\n";
+            boostpython << ");\n\n";
         }
         current_function = "";
     }
 
-    void header() {
-        ifs <<R"c++(/////////////////////////////
+    // --fast-calls: builtin parameters & results are converted inline, everything else by the registry as before.
+    // Functions with a parameter or result that has no direct conversion (e.g. a scalar by pointer) keep def()
+    static bool fastcall_supported(ast_function const& astfunc) {
+        auto direct = [](ast_type_basic const& tb){
+            return scalar_converter_for(tb) != nullptr && (is_cstring(tb) || (!tb.mod_ptr && (!tb.mod_ref || tb.mod_const)));
+        };
+        bool const result_ok = std::visit(overloaded {
+            [&](ast_type_basic const& tb){
+                if (tb.type == type_t::t_void)
+                    return !tb.mod_ptr;
+                if (tb.type == type_t::t_custom)
+                    return !(tb.mod_ptr && tb.mod_ref);
+                return direct(tb) || (scalar_converter_for(tb) != nullptr && tb.mod_ref && !tb.mod_ptr);
+            },
+            [](ast_type_container const& tc){ return !(tc.mod_ptr && tc.mod_ref); }
+        }, astfunc.return_type);
+        if (!result_ok)
+            return false;
+        for (auto const& param : astfunc.params) {
+            bool const param_ok = std::visit(overloaded {
+                [&](ast_basic_variable const& bv){
+                    if (bv.type.type == type_t::t_custom)
+                        return !(bv.type.mod_ptr && bv.type.mod_ref);
+                    return direct(bv.type);
+                },
+                [](ast_container const& con){ return !(con.type.mod_ptr && con.type.mod_ref); }
+            }, param);
+            if (!param_ok)
+                return false;
+        }
+        return true;
+    }
+
+    // What extract<> is given for a custom or container parameter. By value & const& parameters extract the
+    // plain type, which also runs the rvalue converters (e.g. a buffer to a std::vector) like def() does,
+    // extract<T const&> would only find a T already held by a python object. T& & T* stay lvalue only
+    template <typename AstType>
+    static std::string extracted_type(AstType type) {
+        if (!type.mod_ptr && !(type.mod_ref && !type.mod_const))
+            type.mod_const = type.mod_ref = false;
+        return spelling(type);
+    }
+
+    // converts args[i], returns the expression passed to the function
+    std::string fastcall_argument(ast_function const& astfunc, std::size_t i) {
+        std::string const local = "a" + std::to_string(i);
+        std::string const arg   = "args[" + std::to_string(i) + "]";
+        auto registry = [&](std::string const& type){
+            boostpython << "extract<" << type << "> " << local << '(' << arg << ");\n"
+                << "if (!" << local << ".check())\n"
+                << "    return p2_argument_error(\"" << astfunc.name << "\", " << i << ", " << arg << ");\n";
+            return local + "()";
+        };
+        return std::visit(overloaded {
+            [&](ast_basic_variable const& bv){
+                if (bv.type.type == type_t::t_custom)
+                    return registry(extracted_type(bv.type));
+                scalar_converter const* s = scalar_converter_for(bv.type);
+                boostpython << s->spelling << ' ' << local << ";\n"
+                    << "if (!" << s->from_python << '(' << arg << ", " << local << "))\n"
+                    << "    return nullptr;\n";
+                return local;
+            },
+            [&](ast_container const& con){ return registry(extracted_type(con.type)); }
+        }, astfunc.params[i]);
+    }
+
+    // the new reference returned for `result`, reference_existing_object for pointers & references like def()
+    static std::string fastcall_result(ast_type const& result) {
+        auto registry = [](bool is_ptr, bool is_ref){
+            if (is_ptr)
+                return std::string("incref(object(ptr(result)).ptr())");
+            if (is_ref)
+                return std::string("incref(object(ptr(&result)).ptr())");
+            return std::string("incref(object(result).ptr())");
+        };
+        return std::visit(overloaded {
+            [&](ast_type_basic const& tb){
+                if (tb.type == type_t::t_custom)
+                    return registry(tb.mod_ptr, tb.mod_ref);
+                return std::string(scalar_converter_for(tb)->to_python) + "(result)";
+            },
+            [&](ast_type_container const& tc){ return registry(tc.mod_ptr, tc.mod_ref); }
+        }, result);
+    }
+
+    void fastcall(ast_function const& astfunc) {
+        auto const* tb = std::get_if<ast_type_basic>(&astfunc.return_type);
+        bool const returns_void = tb != nullptr && tb->type == type_t::t_void;
+        boostpython << "p2_def_fastcall(\""
+            << astfunc.name
+            << "\", [](PyObject*, PyObject* const*"
+            << (astfunc.params.empty() ? "" : " args")
+            << ", Py_ssize_t nargs) -> PyObject* {\n"
+            << mpcs::indent
+            << "if (!p2_check_nargs(\"" << astfunc.name << "\", nargs, " << astfunc.params.size() << "))\n"
+            << "    return nullptr;\n";
+        std::vector<std::string> call_args;
+        for (std::size_t i = 0; i < astfunc.params.size(); ++i)
+            call_args.push_back(fastcall_argument(astfunc, i));
+        boostpython << "try {\n";
+        {
+            auto body = boostpython.indented();
+            if (!returns_void)
+                boostpython << "auto&& result = ";
+            boostpython << astfunc.name << '(';
+            for (std::size_t i = 0; i < call_args.size(); ++i)
+                boostpython << (i == 0 ? "" : ", ") << call_args[i];
+            boostpython << ");\n";
+            if (returns_void)
+                boostpython << "Py_RETURN_NONE;\n";
+            else
+                boostpython << "return " << fastcall_result(astfunc.return_type) << ";\n";
+        }
+        boostpython << "} catch (...) {\n"
+            << "    handle_exception(); // the registered exception translators, as for def()\n"
+            << "    return nullptr;\n"
+            << "}\n"
+            << mpcs::unindent
+            << "});\n\n";
+    }
+
+    void header(std::ostream& out) {
+        out <<R"c++(/////////////////////////////
 //                         //
 // MPCS 51045 PROJECT 2    //
 // AUTO GENERATED C++ FILE //
 //                         //
 /////////////////////////////
 
-#include <boost/python.hpp>
 )c++";
+        if (options.backend == codegen_backend::capi) {
+            out << capi_includes
+                << "\n#include \"" << sourcefile.filename << "\"\n\n";
+            return;
+        }
+        out << "#include <boost/python.hpp>\n";
         if (include_map_indexing_suite_hpp)
-            ifs << "#include <boost/python/suite/indexing/map_indexing_suite.hpp>\n";
+            out << "#include <boost/python/suite/indexing/map_indexing_suite.hpp>\n";
         if (include_vector_indexing_suite_hpp)
-            ifs << "#include <boost/python/suite/indexing/vector_indexing_suite.hpp>\n";
-        ifs << "\n#include \"" << sourcefile.filename << "\"\n\n";
+            out << "#include <boost/python/suite/indexing/vector_indexing_suite.hpp>\n";
+        if (slots_required)
+            out << "#include <boost/python/object/find_instance.hpp>\n";
+        if (pickle_required)
+            out << "#include <cstring>\n#include <map>\n#include <string>\n#include <type_traits>\n#include <vector>\n";
+        out << "\n#include \"" << sourcefile.filename << "\"\n\n";
+        if (gil_release_required)
+            out << gil_release_support;
+        if (buffer_protocol_required)
+            out << buffer_protocol_support;
+        if (column_required)
+            out << column_support;
+        if (fastcall_required || slots_required)
+            out << fastcall_support;
+        if (fastcall_required)
+            out << boost_fastcall_support;
+        if (slots_required)
+            out << slots_support;
+        if (pickle_required) {
+            out << pickle_support;
+            pickle_functions.flush();
+            out << "#ifndef P2_PICKLE_" << sourcefile.modulename << '\n'
+                << "#  define P2_PICKLE_" << sourcefile.modulename << '\n'
+                << std::string_view(pickle_functions_buffer.str())
+                << "#endif\n\n";
+        }
+    }
+
+    std::string shard_namespace() const {
+        return std::string(sourcefile.modulename) + "_shards";
+    }
+
+    // Each shard only sees the header, so the indexing suites it registers need the operator==s declared
+    std::string shard(std::size_t k, std::string_view registrations) {
+        std::ostringstream out;
+        header(out);
+        for (interned_string custom_type : operator_eqls_types()) {
+            operator_eqls_declaration(out, custom_type);
+        }
+        if (!operator_eqls_required.empty())
+            out << '\n';
+        out << "namespace " << shard_namespace() << " {\n\n"
+            << "void register_part_" << k << "() {\n"
+            << "    using namespace boost::python;\n\n"
+            << registrations
+            << "}\n\n"
+            << "}\n";
+        return std::move(out).str();
+    }
+
+    void shards_module() {
+        ifs << "namespace " << shard_namespace() << " {\n";
+        for (std::size_t k = 0; k < options.shards; ++k)
+            ifs << "void register_part_" << k << "();\n";
+        ifs << "}\n\n"
+            << "BOOST_PYTHON_MODULE("
+            << sourcefile.modulename
+            << "){\n"
+            << mpcs::indent;
+        for (std::size_t k = 0; k < options.shards; ++k)
+            ifs << shard_namespace() << "::register_part_" << k << "();\n";
+        ifs << mpcs::unindent
+            << "}\n";
+    }
+
+    // remembers where the registration just rendered into the boost python section ends
+    void end_of_registration() {
+        if (options.shards == 0)
+            return;
+        boostpython.flush();
+        registration_ends.push_back(static_cast<std::size_t>(boostpython_buffer.tellp()));
+    }
+
+    // Splits the registrations into options.shards contiguous runs of roughly equal size,
+    // registration order is kept because the parts are called in order
+    void split_into_shards(std::string_view section) {
+        std::size_t const begin = registration_ends.front();
+        std::size_t const total = registration_ends.back() - begin;
+        std::vector<std::size_t> part_ends(options.shards, begin);
+        for (std::size_t i = 1; i < registration_ends.size(); ++i) {
+            std::size_t const middle = (registration_ends[i - 1] + registration_ends[i]) / 2 - begin;
+            std::size_t const part = total == 0 ? 0 : std::min(options.shards - 1, middle * options.shards / total);
+            part_ends[part] = registration_ends[i];
+        }
+        for (std::size_t k = 1; k < options.shards; ++k) // parts that got no registrations stay empty
+            part_ends[k] = std::max(part_ends[k], part_ends[k - 1]);
+        std::size_t part_begin = begin;
+        for (std::size_t k = 0; k < options.shards; ++k) {
+            shard_files.push_back(shard(k, section.substr(part_begin, part_ends[k] - part_begin)));
+            part_begin = part_ends[k];
+        }
+    }
+
+
+    static interned_string member_name(ast_variable const& member) {
+        return std::visit([](auto const& var){ return var.name; }, member);
+    }
+
+    // the structs defined in this header that a member of aststruct needs operator== (& std::hash) for
+    template <typename Function>
+    void for_each_struct_member_type(ast_struct const& aststruct, Function&& f) const {
+        auto visit_basic = [&](ast_type_basic const& type){
+            if (type.type == type_t::t_custom && !type.mod_ptr && structs.count(type.custom_typename.id) != 0)
+                f(type.custom_typename);
+        };
+        for (auto const& member : aststruct.members) {
+            std::visit(overloaded {
+                [&](ast_basic_variable const& bv ){ visit_basic(bv.type); },
+                [&](ast_container      const& con){ for (auto const& tb : con.type.template_types) visit_basic(tb); }
+            }, member);
+        }
+    }
+
+    // Member-wise comparison needs the members' own operator==s, so the structs they use are added too
+    void operator_eqls_closure() {
+        std::vector<string_id> pending(operator_eqls_required.begin(), operator_eqls_required.end());
+        while (!pending.empty()) {
+            auto const found = structs.find(pending.back());
+            pending.pop_back();
+            if (found == structs.end())
+                continue;
+            for_each_struct_member_type(*found->second, [this, &pending](interned_string member_type){
+                if (operator_eqls_required.insert(member_type.id).second)
+                    pending.push_back(member_type.id);
+            });
+        }
     }
 
+    void operator_eqls_declaration(std::ostream& out, std::string_view custom_type) {
+        out << "bool operator==("
+            << custom_type
+            << " const & lhs, "
+            << custom_type
+            << " const & rhs);\n";
+    }
 
-    void operator_eqls(std::string_view custom_type) {
-        ifs << "bool operator==("
+    // Note: a type that isn't a struct in this header can only be compared by address
+    void operator_eqls(interned_string custom_type) {
+        stubs << "bool operator==("
             << custom_type
             << " const & lhs, "
             << custom_type
             << " const & rhs) {\n"
             << mpcs::indent
             << "// THIS IS REQUIRED FOR BOOST PYTHON INDEXING SUITE TO WORK CORRECTLY\n"
-            << "// CHANGE IMPLEMENTATION IF NECESSARY\n"
-            << "return &lhs == &rhs;\n"
+            << "// CHANGE IMPLEMENTATION IF NECESSARY\n";
+        auto const found = structs.find(custom_type.id);
+        if (found == structs.end()) {
+            stubs << "return &lhs == &rhs;\n";
+        } else if (found->second->members.empty()) {
+            stubs << "return true;\n";
+        } else {
+            stubs << "return ";
+            auto const& members = found->second->members;
+            for (auto member = members.cbegin(); member != members.cend(); member++) {
+                if (member != members.cbegin())
+                    stubs << "\n    && ";
+                stubs << "lhs." << member_name(*member) << " == rhs." << member_name(*member);
+            }
+            stubs << ";\n";
+        }
+        stubs << mpcs::unindent
+            << "}\n\n";
+    }
+
+    // Only members std::hash knows (or that get a specialization here) are hashed, equal values still hash equal
+    bool hashable(ast_variable const& member) const {
+        auto const* bv = std::get_if<ast_basic_variable>(&member);
+        if (bv == nullptr)
+            return false;
+        if (bv->type.type != type_t::t_custom || bv->type.mod_ptr)
+            return true;
+        return operator_eqls_required.count(bv->type.custom_typename.id) != 0 && structs.count(bv->type.custom_typename.id) != 0;
+    }
+
+    void std_hash(std::vector<interned_string> const& custom_types) {
+        std::vector<ast_struct const*> hashed;
+        for (interned_string custom_type : custom_types) {
+            if (auto const found = structs.find(custom_type.id); found != structs.end())
+                hashed.push_back(found->second);
+        }
+        if (hashed.empty())
+            return;
+        stubs << "#ifndef P2_HASH_COMBINE\n"
+            << "#  define P2_HASH_COMBINE\n"
+            << "inline void p2_hash_combine(std::size_t& seed, std::size_t hash) {\n"
+            << "    seed ^= hash + 0x9e3779b9 + (seed << 6) + (seed >> 2);\n"
+            << "}\n"
+            << "#endif\n\n"
+            << "namespace std {\n";
+        for (ast_struct const* aststruct : hashed) {
+            stubs << "template <> struct hash<"
+                << aststruct->name
+                << "> { size_t operator()("
+                << aststruct->name
+                << " const & value) const noexcept; };\n";
+        }
+        stubs << "}\n\n";
+        for (ast_struct const* aststruct : hashed) {
+            stubs << "std::size_t std::hash<"
+                << aststruct->name
+                << ">::operator()("
+                << aststruct->name
+                << " const & value) const noexcept {\n"
+                << mpcs::indent
+                << "std::size_t seed = 0;\n";
+            for (auto const& member : aststruct->members) {
+                if (hashable(member)) {
+                    stubs << "p2_hash_combine(seed, std::hash<std::decay_t<decltype(value."
+                        << member_name(member)
+                        << ")>>{}(value."
+                        << member_name(member)
+                        << "));\n";
+                }
+            }
+            stubs << "return seed;\n"
+                << mpcs::unindent
+                << "}\n\n";
+        }
+    }
+
+    // --slots: the members that get a typed getset descriptor, the rest stay def_readwrite
+    bool slot_member(ast_variable const& member) const {
+        auto const* bv = std::get_if<ast_basic_variable>(&member);
+        return options.slots && bv != nullptr && scalar_converter_for(bv->type) != nullptr
+            && !bv->type.mod_const && !bv->type.mod_ptr && !bv->type.mod_ref;
+    }
+
+    void slots_table(ast_struct const& aststruct) {
+        boostpython << "static PyGetSetDef p2_members_"
+            << aststruct.name
+            << "[] = {\n"
+            << mpcs::indent;
+        for (auto const& member : aststruct.members) {
+            if (!slot_member(member))
+                continue;
+            auto const& bv = std::get<ast_basic_variable>(member);
+            scalar_converter const* s = scalar_converter_for(bv.type);
+            boostpython << "p2_member<" << aststruct.name << ", &" << aststruct.name << "::" << bv.name
+                << ", &" << s->to_python << ", &" << s->from_python << ">::def(\"" << bv.name << "\"),\n";
+        }
+        boostpython << "{ nullptr, nullptr, nullptr, nullptr, nullptr }\n"
             << mpcs::unindent
+            << "};\n";
+    }
+
+    // --pickle: what p2_pack() can write & p2_unpack() read back, structs only once their own functions exist
+    bool picklable(ast_type_basic const& tb) const {
+        if (tb.mod_const || tb.mod_ptr || tb.mod_ref)
+            return false;
+        if (tb.type == type_t::t_custom)
+            return pickled.count(tb.custom_typename.id) != 0;
+        return tb.type != type_t::t_void && tb.type != type_t::t_unknown;
+    }
+
+    bool picklable(ast_type_container const& tc) const {
+        return (tc.type == container_t::c_vector || tc.type == container_t::c_map)
+            && std::all_of(tc.template_types.cbegin(), tc.template_types.cend(), [this](ast_type_basic const& tb){ return picklable(tb); });
+    }
+
+    bool picklable(ast_struct const& aststruct) const {
+        return std::all_of(aststruct.members.cbegin(), aststruct.members.cend(), [this](ast_variable const& member){
+            return std::visit(overloaded {
+                [this](ast_basic_variable const& bv ){ return picklable(bv.type); },
+                [this](ast_container      const& con){ return picklable(con.type); }
+            }, member);
+        });
+    }
+
+    // the members in declaration order, that order is the whole layout
+    void pickle_functions_for(ast_struct const& aststruct) {
+        pickled.insert(aststruct.name.id);
+        pickle_functions << "inline void p2_pack(p2_pickle_writer& out, "
+            << aststruct.name
+            << " const& value) {\n"
+            << mpcs::indent;
+        for (auto const& member : aststruct.members)
+            pickle_functions << "p2_pack(out, value." << member_name(member) << ");\n";
+        pickle_functions << mpcs::unindent
+            << "}\n\n"
+            << "inline void p2_unpack(p2_pickle_reader& in, "
+            << aststruct.name
+            << "& value) {\n"
+            << mpcs::indent;
+        for (auto const& member : aststruct.members)
+            pickle_functions << "p2_unpack(in, value." << member_name(member) << ");\n";
+        pickle_functions << mpcs::unindent
             << "}\n\n";
     }
 
     void struct_(ast_struct const& aststruct) {
         current_struct = aststruct.name;
-        if (generating_boostpython()) {
-            ifs << "class_<"
+        if (generating_headers()) {
+            structs.try_emplace(aststruct.name.id, &aststruct);
+        } else if (generating_boostpython()) {
+            bool const slots = std::any_of(aststruct.members.cbegin(), aststruct.members.cend(),
+                [this](ast_variable const& member){ return slot_member(member); });
+            if (slots) {
+                slots_table(aststruct);
+                boostpython << "p2_slots(";
+                slots_required = true;
+            }
+            boostpython << "class_<"
                 << aststruct.name
                 << ">(\""
                 << aststruct.name
-                << "\")"
-                << mpcs::indent;
-            for (auto const& member : aststruct.members) {
-                variable(member);
+                << "\")";
+            {
+                auto members = boostpython.indented();
+                for (auto const& member : aststruct.members) {
+                    if (!slot_member(member))
+                        variable(member);
+                }
+                if (options.pickle && picklable(aststruct)) {
+                    pickle_functions_for(aststruct);
+                    pickle_required = true;
+                    boostpython << "\n.def_pickle(p2_pickle_suite<" << aststruct.name << ">())";
+                }
             }
-            ifs << ";\n\n"
-                << mpcs::unindent;
+            if (slots)
+                boostpython << ", p2_members_" << aststruct.name << ')';
+            boostpython << ";\n\n";
         }
         current_struct = "";
     }
@@ -306,43 +1419,28 @@ struct cppfile_ast_visitor : ast_visitor_base {
     void type_basic(ast_type_basic const& asttype, container_t c_type = container_t::c_unknown) {
         if (generating_headers()) {
             if (c_type != container_t::c_unknown && asttype.type == type_t::t_custom)
-                operator_eqls_required.insert(asttype.custom_typename);
+                operator_eqls_required.insert(asttype.custom_typename.id);
             if (c_type == container_t::c_map)
                 include_map_indexing_suite_hpp = true;
             else if (c_type == container_t::c_vector)
                 include_vector_indexing_suite_hpp = true;
         } else if (generating_stubs()) {
             if (asttype.mod_unsigned)
-                ifs << "unsigned ";
+                stubs << "unsigned ";
             if (asttype.type == type_t::t_custom) {
-                ifs << asttype.custom_typename;
+                stubs << asttype.custom_typename;
             } else
-                ifs << asttype.type;
-            ifs << ' ';
+                stubs << asttype.type;
+            stubs << ' ';
             if (asttype.mod_const)
-                ifs << "const ";
+                stubs << "const ";
             if (asttype.mod_ptr)
-                ifs << "* ";
+                stubs << "* ";
             if (asttype.mod_ref)
-                ifs << "& ";
-            if (c_type != container_t::c_unknown) {
-                if (asttype.mod_unsigned)
-                    current_container += "unsigned ";
-                if (asttype.type == type_t::t_custom) {
-                    current_container += asttype.custom_typename;
-                } else
-                    current_container += to_string(asttype.type);
-                current_container += ' ';
-                if (asttype.mod_const)
-                    current_container += "const ";
-                if (asttype.mod_ptr)
-                    current_container += "* ";
-                if (asttype.mod_ref)
-                    current_container += "& ";
-            }
+                stubs << "& ";
         } else if (generating_boostpython()) {
             if (asttype.mod_ptr || asttype.mod_ref)
-                ifs << ", return_value_policy<reference_existing_object>()";
+                boostpython << ", return_value_policy<reference_existing_object>()";
         }
     }
 
@@ -352,31 +1450,26 @@ struct cppfile_ast_visitor : ast_visitor_base {
                 type_basic(typebasic, asttype.type);
             }
         } else if (generating_stubs()) {
-            ifs << asttype.type
+            stubs << asttype.type
                 << '<';
-            current_container += to_string(asttype.type);
-            current_container += '<';
             for (auto typebasic = asttype.template_types.cbegin(); typebasic != asttype.template_types.cend(); typebasic++) {
                 type_basic(*typebasic, asttype.type);
-                if (std::next(typebasic) != asttype.template_types.cend()) {
-                    ifs << ", "; // ostream_joiner would be nice here...
-                    current_container += ", ";
-                }
+                if (std::next(typebasic) != asttype.template_types.cend())
+                    stubs << ", "; // ostream_joiner would be nice here...
             }
-            ifs << "> ";
-            current_container += '>';
+            stubs << "> ";
             if (asttype.mod_const)
-                ifs << "const ";
+                stubs << "const ";
             if (asttype.mod_ptr)
-                ifs << "* ";
+                stubs << "* ";
             if (asttype.mod_ref)
-                ifs << "& ";
+                stubs << "& ";
 
-            _add_container_to_indexing_suite(std::move(current_container), asttype.type);
-            current_container.clear(); // moved from l-value is in "valid but unspecified state", probably is empty but that is not guaranteed so let's clear it to be safe
+            _add_container_to_indexing_suite(registered_name(asttype), asttype.type, options.buffer_protocol ? buffer_format(asttype) : 0,
+                options.buffer_protocol ? column_element(asttype) : 0, options.pickle && picklable(asttype));
         } else if (generating_boostpython()) {
             if (asttype.mod_ptr || asttype.mod_ref)
-                ifs << ", return_value_policy<reference_existing_object>()";
+                boostpython << ", return_value_policy<reference_existing_object>()";
         }
     }
 
@@ -388,70 +1481,180 @@ struct cppfile_ast_visitor : ast_visitor_base {
 
     }
 
-    void _add_container_to_indexing_suite(std::string&& container_name, container_t c_type) {
-        if (indexing_suite_required.find(container_name) == indexing_suite_required.end()) {
-            std::string mangled_container_name = mangle_name(container_name);
-            indexing_suite_required.insert({ std::move(container_name), { mangled_container_name, c_type } });
+    // the struct of a std::vector<Struct> whose arithmetic members get column views, 0 if none
+    string_id column_element(ast_type_container const& asttype) const {
+        if (asttype.type != container_t::c_vector || asttype.template_types.size() != 1)
+            return 0;
+        ast_type_basic const& element = asttype.template_types.front();
+        if (element.type != type_t::t_custom || element.mod_const || element.mod_ptr || element.mod_ref)
+            return 0;
+        return columns(element.custom_typename.id).empty() ? 0 : element.custom_typename.id;
+    }
+
+    void _add_container_to_indexing_suite(std::string const& container_name, container_t c_type, char format, string_id element_struct, bool pickle) {
+        interned_string const container = symbols.intern_copy(container_name);
+        if (indexing_suite_required.find(container.id) == indexing_suite_required.end()) {
+            indexing_suite_required.insert({ container.id, { mangle_name(container), c_type, format, element_struct, pickle } });
+            pickle_required          |= pickle;
+            buffer_protocol_required |= format != 0;
+            column_required          |= element_struct != 0;
         }
     }
 
+    // the sets below are keyed on string_id, sort by spelling when emitting so the output order doesn't depend on interning order
+    std::vector<interned_string> sorted_by_spelling(std::vector<interned_string>&& names) const {
+        std::sort(names.begin(), names.end(), [](interned_string lhs, interned_string rhs){ return lhs.spelling < rhs.spelling; });
+        return std::move(names);
+    }
+
+    std::vector<interned_string> operator_eqls_types() const {
+        std::vector<interned_string> names;
+        for (string_id id : operator_eqls_required)
+            names.push_back(symbols[id]);
+        return sorted_by_spelling(std::move(names));
+    }
+
+    std::vector<interned_string> indexing_suite_containers() const {
+        std::vector<interned_string> names;
+        for (auto const& [id, _] : indexing_suite_required)
+            names.push_back(symbols[id]);
+        return sorted_by_spelling(std::move(names));
+    }
+
+    string_pool&                                    symbols;
     cppfile_ast_visitor                             my_ast_visitor;
-    std::set<std::string_view, std::less<>>         operator_eqls_required;
-    std::map<
-        std::string,
-        std::pair<std::string, container_t>,
-        std::less<>>                                indexing_suite_required;
+    std::unordered_set<string_id>                   operator_eqls_required;
+    std::unordered_map<string_id, ast_struct const*> structs; // the structs defined in this header, by name
+    std::unordered_set<string_id>                   pickled; // the structs given p2_pack/p2_unpack, see --pickle
+    struct indexing_suite {
+        std::string mangled_name;
+        container_t type;
+        char        format;         // buffer_format() if the class also exports a buffer
+        string_id   element_struct; // with --buffer-protocol, the element type of a vector that gets column views
+        bool        pickle;         // with --pickle, the elements can be pickled so the class is too
+    };
+    std::unordered_map<string_id, indexing_suite>   indexing_suite_required;
     bool                                            include_map_indexing_suite_hpp;
     bool                                            include_vector_indexing_suite_hpp;
-    std::string                                     current_container;
     std::string_view                                current_function;
     std::string_view                                current_struct;
+    bool                                            buffer_protocol_required;
+    bool                                            gil_release_required;
+    bool                                            fastcall_required;
+    bool                                            column_required;
+    bool                                            slots_required;
+    bool                                            pickle_required;
+    // Note: rendered during the traversal, written out after the header once its includes are known
+    std::ostringstream                              stubs_buffer;
+    std::ostringstream                              boostpython_buffer;
+    std::ostringstream                              pickle_functions_buffer;
+    mpcs::IndentStream                              stubs;
+    mpcs::IndentStream                              boostpython;
+    mpcs::IndentStream                              pickle_functions; // emitted by header(), so the shards get them too
+    codegen_options                                 options;
+    std::vector<std::size_t>                        registration_ends; // offsets into boostpython_buffer, when sharding
+    std::vector<std::string>                        shard_files;
 
 public:
-    cplusplus_generator(headerfile const& source, std::unique_ptr<ast> const& my_ast) : 
+    cplusplus_generator(headerfile const& source, std::unique_ptr<ast> const& my_ast, string_pool& _symbols, codegen_options const& _options = {}) :
         code_generator_base(source.cppfile, source, my_ast),
+        symbols(_symbols),
         my_ast_visitor(*this),
         operator_eqls_required(),
+        structs(),
+        pickled(),
         indexing_suite_required(),
         include_map_indexing_suite_hpp(false),
         include_vector_indexing_suite_hpp(false),
-        current_container(),
         current_function(),
-        current_struct()
+        current_struct(),
+        buffer_protocol_required(false),
+        gil_release_required(false),
+        fastcall_required(false),
+        column_required(false),
+        slots_required(false),
+        pickle_required(false),
+        stubs_buffer(),
+        boostpython_buffer(),
+        pickle_functions_buffer(),
+        stubs(stubs_buffer),
+        boostpython(boostpython_buffer),
+        pickle_functions(pickle_functions_buffer),
+        options(_options),
+        registration_ends(),
+        shard_files()
         {}
 
-    // first pass
-    void generate_header() {
-        my_state = state::header;
-        for (auto const& node : *my_ast) {
-            std::visit(my_ast_visitor, node);
+    // Single traversal: each node is analysed for the header's includes and rendered into the stubs
+    // & boost python sections, which are appended to the file once the header has been written.
+    void generate() {
+        if (options.backend == codegen_backend::capi) {
+            generate_capi();
+            return;
         }
-        header();
-    }
-
-    // second pass
-    void generate_stubs() {
-        my_state = state::stubs;
+        boostpython_start();
+        end_of_registration();
         for (auto const& node : *my_ast) {
-            std::visit(my_ast_visitor, node);
+            for (state section : { state::header, state::stubs, state::boostpython }) {
+                my_state = section;
+                std::visit(my_ast_visitor, node);
+            }
+            end_of_registration();
         }
-        for (std::string_view custom_type : operator_eqls_required) {
+        operator_eqls_closure();
+        auto const custom_types = operator_eqls_types();
+        if (custom_types.size() > 1) { // member-wise comparisons may use each other
+            for (interned_string custom_type : custom_types)
+                operator_eqls_declaration(stubs, custom_type);
+            stubs << '\n';
+        }
+        for (interned_string custom_type : custom_types) {
             operator_eqls(custom_type);
         }
+        if (options.std_hash)
+            std_hash(custom_types);
+        for (interned_string container_name : indexing_suite_containers()) {
+            auto const& [mangled_name, c_type, format, element_struct, pickle] = indexing_suite_required.at(container_name.id);
+            boostpython_indexing_suite(container_name, mangled_name, c_type, format, element_struct, pickle);
+            end_of_registration();
+        }
+        boostpython_end();
+        my_state = state::done;
+
+        header(ifs);
+        stubs.flush();
+        boostpython.flush();
+        ifs << std::string_view(stubs_buffer.str());
+        if (options.shards == 0) {
+            ifs << std::string_view(boostpython_buffer.str());
+        } else {
+            shards_module();
+            split_into_shards(boostpython_buffer.str());
+        }
     }
 
-    // third pass
-    void generate_boostpython() {
-        my_state = state::boostpython;
-        boostpython_start();
+    // The stubs as above, then the capi backend's binding section instead of the boost python one
+    void generate_capi() {
         for (auto const& node : *my_ast) {
-            std::visit(my_ast_visitor, node);
-        }
-        for (auto const& [container_name, container_info] : indexing_suite_required) {
-            boostpython_indexing_suite(container_name, container_info.first, container_info.second);
+            for (state section : { state::header, state::stubs }) {
+                my_state = section;
+                std::visit(my_ast_visitor, node);
+            }
         }
-        boostpython_end();
         my_state = state::done;
+
+        header(ifs);
+        stubs.flush();
+        ifs << std::string_view(stubs_buffer.str());
+        capi_generator(ifs, sourcefile.modulename, my_ast, options.release_gil).generate();
+    }
+
+    // returns false if none of the files on disk changed
+    bool write_output() {
+        bool changed = code_generator_base::write_output();
+        for (std::size_t k = 0; k < shard_files.size(); ++k)
+            changed |= write_if_changed(sourcefile.shard_cppfile(k), shard_files[k]);
+        return changed;
     }
 };
 
@@ -464,7 +1667,7 @@ struct pythonfile_ast_visitor : ast_visitor_base {
 
     virtual void operator() (ast_basic_variable const& node) const override {}
     virtual void operator() (ast_container      const& node) const override {}
-    virtual void operator() (ast_function       const& node) const override {}
+    virtual void operator() (ast_function       const& node) const override { code_generator.function(node); }
     virtual void operator() (ast_include        const& node) const override {}
     virtual void operator() (ast_struct         const& node) const override { code_generator.class_(node); }
 };
@@ -473,7 +1676,7 @@ struct pythonfile_ast_visitor : ast_visitor_base {
 
     void class_(ast_struct const& aststruct) {
         if (generating_stubs()) {
-            if (structs_seen.find(aststruct.name) == structs_seen.end()) {
+            if (structs_seen.find(aststruct.name.id) == structs_seen.end()) {
                 ifs << "\nnew_"
                     << aststruct.name
                     << " = "
@@ -484,11 +1687,82 @@ struct pythonfile_ast_visitor : ast_visitor_base {
                     << "new_"
                     << aststruct.name
                     << ") )\n";
-                structs_seen.insert(aststruct.name);
+                structs_seen.insert(aststruct.name.id);
             }
         }
     }
 
+    // a python expression for a made up benchmark argument, empty if there is none (e.g. a scalar by non-const reference).
+    // Vectors of arithmetic types get filled() so the call does enough work for the threads to overlap
+    std::string benchmark_argument(ast_variable const& astvar) const {
+        std::string const module(sourcefile.modulename);
+        return std::visit(overloaded {
+            [&](ast_basic_variable const& bv){
+                ast_type_basic const& tb = bv.type;
+                if (tb.type == type_t::t_custom)
+                    return !(tb.mod_ptr && tb.mod_ref) && structs_seen.count(tb.custom_typename.id) != 0
+                        ? module + '.' + std::string(tb.custom_typename.spelling) + "()" : std::string();
+                if (is_cstring(tb))
+                    return std::string("''");
+                if (tb.mod_ptr || (tb.mod_ref && !tb.mod_const))
+                    return std::string();
+                switch (tb.type) {
+                    case type_t::t_char   : return std::string("'a'");
+                    case type_t::t_string : return std::string("''");
+                    case type_t::t_float  :
+                    case type_t::t_double : return std::string("0.0");
+                    case type_t::t_int    :
+                    case type_t::t_long   :
+                    case type_t::t_short  : return std::string("0");
+                    default               : return std::string();
+                }
+            },
+            [&](ast_container const& con){
+                if (con.type.mod_ptr && con.type.mod_ref)
+                    return std::string();
+                std::string const empty = module + '.' + mangle_name(registered_name(con.type)) + "()";
+                if (char const format = buffer_format(con.type); format != 0)
+                    return "filled(" + empty + ", " + (format == 'c' || format == 'B' ? "'a'" : "1") + ')';
+                return empty;
+            }
+        }, astvar);
+    }
+
+    // functions registered with --release-gil get a benchmark, with made up arguments when every parameter has one
+    void function(ast_function const& astfunc) {
+        if (generating_stubs() && options.releases_gil(astfunc.name)) {
+            std::vector<std::string> arguments;
+            for (auto const& astvar : astfunc.params)
+                arguments.push_back(benchmark_argument(astvar));
+            bool const runnable = std::none_of(arguments.cbegin(), arguments.cend(), [](std::string const& arg){ return arg.empty(); });
+            if (!runnable)
+                ifs << "# ";
+            ifs << "benchmark_threads("
+                << sourcefile.modulename
+                << '.'
+                << astfunc.name;
+            for (std::size_t i = 0; i < arguments.size(); ++i) {
+                ifs << ", ";
+                if (runnable)
+                    ifs << arguments[i];
+                else
+                    ifs << std::visit([](auto const& var){ return var.name; }, astfunc.params[i]);
+            }
+            ifs << ')';
+            if (!runnable)
+                ifs << "  # fill in arguments for a representative workload";
+            ifs << '\n';
+        }
+    }
+
+    bool releases_gil() const {
+        for (auto const& node : *my_ast) {
+            if (auto const* astfunc = std::get_if<ast_function>(&node); astfunc && options.releases_gil(astfunc->name))
+                return true;
+        }
+        return false;
+    }
+
     void header() {
         ifs << R"python(################################
 ##                            ##
@@ -500,16 +1774,50 @@ struct pythonfile_ast_visitor : ast_visitor_base {
 )python";
         ifs << "import "
             << sourcefile.modulename
-            << "\n\nif __name__ == \"__main__\":\n"
+            << '\n';
+        if (releases_gil()) {
+            ifs << R"python(import threading
+import time
+
+
+def benchmark_threads(function, *args, threads=4):
+    """Calls function(*args) `threads` times one after another, then once on each of `threads` threads.
+    A function registered with --release-gil runs concurrently, so the threaded run should be up to `threads` times faster."""
+    start = time.perf_counter()
+    for _ in range(threads):
+        function(*args)
+    serial = time.perf_counter() - start
+    workers = [threading.Thread(target=function, args=args) for _ in range(threads)]
+    start = time.perf_counter()
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        worker.join()
+    concurrent = time.perf_counter() - start
+    print(f"{function.__name__}: serial {serial:.3f}s, {threads} threads {concurrent:.3f}s ({serial / concurrent:.1f}x)")
+
+
+def filled(vector, value, count=1000000):
+    """Appends `count` copies of value to a wrapped std::vector, a workload the threads can overlap on."""
+    vector.extend([value] * count)
+    return vector
+
+)python";
+        }
+        ifs << "\nif __name__ == \"__main__\":\n"
             << mpcs::indent;
     }
 
-    std::set<std::string_view, std::less<>> structs_seen;
+    std::unordered_set<string_id> structs_seen;
+    codegen_options               options;
 public:
-    python_generator(headerfile const& source, std::unique_ptr<ast> const& my_ast) :
+    using code_generator_base::write_output;
+
+    python_generator(headerfile const& source, std::unique_ptr<ast> const& my_ast, codegen_options const& _options = {}) :
         code_generator_base(source.pyfile, source, my_ast),
         my_ast_visitor(*this),
-        structs_seen()
+        structs_seen(),
+        options(_options)
         {}
 
     void generate_header() {
@@ -526,25 +1834,31 @@ public:
     }
 };
 
-void write_cppfile(headerfile const& sourcefile, std::unique_ptr<ast> const& my_ast) {
-    auto cppgen = cplusplus_generator(sourcefile, my_ast);
-    cppgen.generate_header();
-    cppgen.generate_stubs();
-    cppgen.generate_boostpython();
+void write_cppfile(headerfile const& sourcefile, std::unique_ptr<ast> const& my_ast, string_pool& symbols, codegen_options const& options = {}) {
+    auto cppgen = cplusplus_generator(sourcefile, my_ast, symbols, options);
+    cppgen.generate();
+    cppgen.write_output();
 }
 
-void write_pythonfile(headerfile const& sourcefile, std::unique_ptr<ast> const& my_ast) {
-    auto pythongen = python_generator(sourcefile, my_ast);
+void write_pythonfile(headerfile const& sourcefile, std::unique_ptr<ast> const& my_ast, codegen_options const& options = {}) {
+    auto pythongen = python_generator(sourcefile, my_ast, options);
     pythongen.generate_header();
     pythongen.generate_stubs();
+    pythongen.write_output();
 }
 
-void cpptopy(std::string_view sourcefile, std::unique_ptr<ast> const& my_ast) {    
+// Note: symbols is the pool my_ast was interned in, only the c++ generator adds to it so the two tasks don't race on it
+void cpptopy(std::string_view sourcefile, std::unique_ptr<ast> const& my_ast, string_pool& symbols, executor& exec, codegen_options const& options = {}) {
     headerfile hfile(sourcefile);
-    std::thread cpp(write_cppfile,    std::cref(hfile), std::cref(my_ast));
-    std::thread py (write_pythonfile, std::cref(hfile), std::cref(my_ast));
-    cpp.join();
-    py.join();
+    exec.run_all({
+        [&]{ write_cppfile   (hfile, my_ast, symbols, options); },
+        [&]{ write_pythonfile(hfile, my_ast, options);          }
+    });
+}
+
+void cpptopy(std::string_view sourcefile, std::unique_ptr<ast> const& my_ast, string_pool& symbols) {
+    inline_executor exec;
+    cpptopy(sourcefile, my_ast, symbols, exec);
 }
 
 }
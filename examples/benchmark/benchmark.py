@@ -0,0 +1,68 @@
+"""Per-call overhead of the functions in scalars.h, bound through the boost python converter
+registry (registry/) and with --fast-calls (fastcall/). Run by `make fastcall_benchmark`.
+Both variants are built with --buffer-protocol, total() has to accept the same arguments either way.
+Each variant is timed in its own interpreter: both register the same c++ types in boost python's
+process wide converter registry, so in one process the second module would use the first one's converters."""
+import array
+import importlib.util
+import json
+import pathlib
+import subprocess
+import sys
+import sysconfig
+import timeit
+
+HERE = pathlib.Path(__file__).parent
+VARIANTS = ("registry", "fastcall")
+CALLS = {
+    "add":   ("m.add(1, 2)",),
+    "lerp":  ("m.lerp(0.0, 10.0, 0.25)",),
+    "clamp": ("m.clamp(15, 0, 10)",),
+    "mask":  ("m.mask(1023, 4)",),
+    "greet": ("m.greet('world')",),
+    "first": ("m.first('word')",),
+    "total": ("m.total(vec)",),
+    "total(buffer)": ("m.total(buf)",),
+}
+
+
+def load(variant):
+    path = HERE / variant / ("scalars" + sysconfig.get_config_var("EXT_SUFFIX"))
+    spec = importlib.util.spec_from_file_location("scalars", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def arguments(module):
+    vec = module.vector_double()
+    vec.extend([1.5, 2.0, 3.0])
+    return {"m": module, "vec": vec, "buf": array.array("d", [1.5, 2.0, 3.0])}
+
+
+def per_call_ns(module, statement, number=200000):
+    best = min(timeit.repeat(statement, globals=arguments(module), number=number, repeat=5))
+    return best / number * 1e9
+
+
+def time_variant(variant):
+    """Runs in the child process, prints {statement: ns per call} as json."""
+    module = load(variant)
+    print(json.dumps({statement: per_call_ns(module, statement) for (statement,) in CALLS.values()}))
+
+
+def timings(variant):
+    child = subprocess.run([sys.executable, __file__, variant], check=True, capture_output=True, text=True)
+    return json.loads(child.stdout)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 2:
+        time_variant(sys.argv[1])
+        sys.exit(0)
+    results = {variant: timings(variant) for variant in VARIANTS}
+    print(f"{'call':<26}{'registry':>12}{'fastcall':>12}")
+    for (statement,) in CALLS.values():
+        registry = results["registry"][statement]
+        fastcall = results["fastcall"][statement]
+        print(f"{statement:<26}{registry:>10.0f}ns{fastcall:>10.0f}ns  ({registry / fastcall:.1f}x)")
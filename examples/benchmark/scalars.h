@@ -0,0 +1,28 @@
+#include <string>
+#include <vector>
+
+inline long add(long a, long b) {
+    return a + b;
+}
+
+inline double lerp(double a, double b, double t) {
+    return a + (b - a) * t;
+}
+
+inline int clamp(int value, int low, int high) {
+    return value < low ? low : value > high ? high : value;
+}
+
+inline unsigned int mask(unsigned int value, unsigned short bits) {
+    return value & ((1u << bits) - 1u);
+}
+
+inline std::string greet(std::string const& name) {
+    return "hello " + name;
+}
+
+inline char first(char const* word) {
+    return word[0];
+}
+
+double total(std::vector<double> const& values);
@@ -0,0 +1,47 @@
+"""Checks examples/median.h built with --buffer-protocol: the median functions take any contiguous buffer of
+doubles (array.array, numpy) as their std::vector<double>, and a wrapped vector exports its memory.
+Run by `make median_buffer_example`."""
+import array
+import importlib.util
+import pathlib
+import sysconfig
+
+HERE = pathlib.Path(__file__).parent
+
+
+def load():
+    path = HERE / "buffers" / ("median" + sysconfig.get_config_var("EXT_SUFFIX"))
+    spec = importlib.util.spec_from_file_location("median", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+if __name__ == "__main__":
+    median = load()
+    inputs = [array.array("d", [5.0, 1.0, 3.0, 9.0, 7.0])]
+    try:
+        import numpy
+        inputs.append(numpy.array([5.0, 1.0, 3.0, 9.0, 7.0]))
+    except ImportError:
+        print("numpy not installed, only array.array is checked")
+    for values in inputs:
+        for function in (median.median_sort, median.median_partial_sort, median.median_nth_element):
+            assert function(values) == 5.0, (function.__name__, type(values).__name__)
+
+    scalar = memoryview(array.array("d", [1.0])).cast("B").cast("d", shape=[])  # 0-d, not a vector of one
+    for rejected in (array.array("i", [1, 2, 3]), scalar):
+        try:
+            median.median_sort(rejected)
+        except TypeError:
+            pass
+        else:
+            raise AssertionError(f"median_sort accepted {rejected!r}")
+
+    vec = median.vector_double()
+    vec.extend([1.0, 2.0, 4.0])
+    view = memoryview(vec)
+    assert (view.format, view.shape, view.strides) == ("d", (3,), (8,))
+    view[0] = 3.0
+    assert vec[0] == 3.0 and median.median_sort(vec) == 3.0
+    print("median.h buffer protocol: ok")
@@ -0,0 +1,64 @@
+#ifndef P2_EXECUTOR_H
+#  define P2_EXECUTOR_H
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "threadpool.h"
+
+namespace proj2 {
+
+// Where cpptopy() runs its independent generation tasks (the .cpp and the .py writer).
+// run_all() returns once every task has finished and rethrows the first exception.
+class executor {
+public:
+    virtual ~executor() = default;
+    virtual void run_all(std::vector<std::function<void()>> tasks) = 0;
+};
+
+// Runs the tasks one after another on the calling thread, cheapest for small headers
+class inline_executor : public executor {
+public:
+    void run_all(std::vector<std::function<void()>> tasks) override {
+        std::exception_ptr first_error;
+        for (auto& task : tasks) {
+            try { task(); } catch (...) { if (!first_error) first_error = std::current_exception(); }
+        }
+        if (first_error)
+            std::rethrow_exception(first_error);
+    }
+};
+
+// Submits the tasks to a pool owned by someone else, e.g. the pool a batch of headers is running on.
+// Safe to use from inside that pool's workers, waiting helps run queued work.
+class shared_pool_executor : public executor {
+    thread_pool& pool;
+public:
+    explicit shared_pool_executor(thread_pool& _pool) : pool(_pool) {}
+
+    void run_all(std::vector<std::function<void()>> tasks) override {
+        task_group group(pool);
+        for (auto& task : tasks)
+            group.run(std::move(task));
+        group.wait();
+    }
+};
+
+// Owns its own pool, reused for every header it is given
+class thread_pool_executor : public executor {
+    std::unique_ptr<thread_pool> pool;
+    shared_pool_executor         pool_executor;
+public:
+    explicit thread_pool_executor(std::size_t thread_count = std::thread::hardware_concurrency()) :
+        pool(std::make_unique<thread_pool>(thread_count)), pool_executor(*pool) {}
+
+    void run_all(std::vector<std::function<void()>> tasks) override {
+        pool_executor.run_all(std::move(tasks));
+    }
+};
+
+}
+#endif
@@ -1,61 +1,157 @@
 #ifndef INDENT_STREAM_H
 #  define INDENT_STREAM_H
 
+#include <cstring>
 #include <streambuf>
 #include <ostream>
+#include <string>
 
 namespace mpcs {
 
+// Buffered: characters collect unindented in the put area and are indented a whole
+// block at a time on overflow/sync, then handed to the wrapped streambuf in one sputn.
 class IndentStreamBuf : public std::streambuf
 {
 public:
-    IndentStreamBuf(std::ostream &stream)
-        : wrappedStreambuf(stream.rdbuf()), isLineStart(true), myIndent(0) {}
+    IndentStreamBuf(std::ostream &stream, size_t width = 4, bool useTabs = false)
+        : wrappedStreambuf(stream.rdbuf()), isLineStart(true), myDepth(0),
+          myIndent(), indentUnit(useTabs ? std::string(1, '\t') : std::string(width, ' ')) {
+        setp(buffer, buffer + bufferSize);
+    }
+    ~IndentStreamBuf() override { sync(); }
+
+    size_t depth() const { return myDepth; }
+    // Note: pending text was written under the old indent, so it is flushed first
+    void setDepth(size_t depth) {
+        drain();
+        myDepth = depth;
+        myIndent.clear();
+        for (size_t i = 0; i < myDepth; i++)
+            myIndent += indentUnit;
+    }
+
+protected:
 	virtual int overflow(int outputVal) override
 	{
+        drain();
 		if (outputVal == traits_type::eof())
-			return traits_type::eof();
-        if(outputVal == '\n') {
-            isLineStart = true;
-        } else if(isLineStart) {
-            for(size_t i = 0; i < myIndent; i++) {
-               wrappedStreambuf->sputc(' ');
-            }
-            isLineStart = false;
-        }
-        wrappedStreambuf->sputc(static_cast<char>(outputVal));
+			return traits_type::not_eof(outputVal);
+        *pptr() = traits_type::to_char_type(outputVal);
+        pbump(1);
 		return outputVal;
 	}
-protected:
+
+    virtual std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        if (n <= epptr() - pptr()) {
+            std::memcpy(pptr(), s, n);
+            pbump(static_cast<int>(n));
+        } else {
+            drain();
+            write(s, n);
+        }
+        return n;
+    }
+
+    virtual int sync() override
+    {
+        drain();
+        return wrappedStreambuf->pubsync();
+    }
+
+private:
+    static constexpr size_t bufferSize = 8192;
+
+    // indent [s, s + n) into `indented` and pass it on in one block
+    void write(const char *s, std::streamsize n) {
+        const char *const end = s + n;
+        while (s != end) {
+            const char *nl = static_cast<const char *>(std::memchr(s, '\n', end - s));
+            const char *lineEnd = nl ? nl : end;
+            if (isLineStart && s != lineEnd)
+                indented += myIndent;
+            indented.append(s, lineEnd);
+            if (nl) {
+                indented.push_back('\n');
+                isLineStart = true;
+                s = nl + 1;
+            } else {
+                isLineStart = isLineStart && s == lineEnd;
+                s = end;
+            }
+        }
+        wrappedStreambuf->sputn(indented.data(), indented.size());
+        indented.clear();
+    }
+
+    void drain() {
+        if (pptr() != pbase())
+            write(pbase(), pptr() - pbase());
+        setp(buffer, buffer + bufferSize);
+    }
+
     std::streambuf *wrappedStreambuf;
     bool isLineStart;
-public:
-    size_t myIndent;
+    size_t myDepth;
+    std::string myIndent;   // indentUnit repeated myDepth times
+    std::string indentUnit;
+    std::string indented;
+    char buffer[bufferSize];
 };
 
+// Indentation is a member of the stream, so `ifs << mpcs::indent` needs no RTTI.
+// The operator<< overloads below keep the IndentStream type through a chain of <<s.
 class IndentStream : public std::ostream
 {
 public:
-    IndentStream(std::ostream &wrappedStream)
-      : std::ostream(new IndentStreamBuf(wrappedStream)) {
+    IndentStream(std::ostream &wrappedStream, size_t width = 4, bool useTabs = false)
+      : std::ostream(nullptr), buf(wrappedStream, width, useTabs) {
+        rdbuf(&buf);
+    }
+
+    void indent() { buf.setDepth(buf.depth() + 1); }
+    void unindent() {
+        if (buf.depth() != 0)
+            buf.setDepth(buf.depth() - 1);
     }
-    ~IndentStream() { delete this->rdbuf(); }
+    size_t depth() const { return buf.depth(); }
+
+    // indents until the end of the enclosing block
+    class Scope {
+        IndentStream &stream;
+    public:
+        explicit Scope(IndentStream &_stream) : stream(_stream) { stream.indent(); }
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+        ~Scope() { stream.unindent(); }
+    };
+    Scope indented() { return Scope(*this); }
+
+private:
+    IndentStreamBuf buf;
 };
 
+struct indent_t {};
+struct unindent_t {};
+inline constexpr indent_t indent{};
+inline constexpr unindent_t unindent{};
 
-inline std::ostream &indent(std::ostream &ostr)
+inline IndentStream &operator<<(IndentStream &ostr, indent_t)
 {
-    IndentStreamBuf *out = dynamic_cast<IndentStreamBuf *>(ostr.rdbuf());
-	if (nullptr != out) {
-        out->myIndent += 4;
-    }
+    ostr.indent();
+    return ostr;
+}
+
+inline IndentStream &operator<<(IndentStream &ostr, unindent_t)
+{
+    ostr.unindent();
     return ostr;
 }
 
-inline std::ostream &unindent(std::ostream &ostr)
+template<typename T>
+IndentStream &operator<<(IndentStream &ostr, T const &value)
 {
-    IndentStreamBuf *out = dynamic_cast<IndentStreamBuf *>(ostr.rdbuf());
-    out->myIndent -= 4;
+    static_cast<std::ostream &>(ostr) << value;
     return ostr;
 }
 
@@ -0,0 +1,93 @@
+#ifndef P2_OUTPUTCACHE_H
+#  define P2_OUTPUTCACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include "cpptopy.h"
+#include "outputfile.h"
+#include "sourcebuffer.h"
+
+namespace proj2 {
+
+// On-disk cache of generated .cpp & .py files, keyed on everything the output depends on: the header's
+// bytes, its file name (it is #included & names the module), the codegen options and the generator version.
+// Note: entries are written with write_if_changed(), so concurrent workers & processes can share a directory
+class output_cache {
+    std::filesystem::path    dir;
+    std::atomic<std::size_t> lookups;
+    std::atomic<std::size_t> hits;
+
+    // 64-bit FNV-1a, stable across builds & platforms unlike std::hash
+    static std::uint64_t hash(std::initializer_list<std::string_view> parts) noexcept {
+        std::uint64_t h = 0xcbf29ce484222325ull;
+        for (std::string_view part : parts) {
+            for (char ch : part)
+                h = (h ^ static_cast<unsigned char>(ch)) * 0x100000001b3ull;
+            h = (h ^ 0xffu) * 0x100000001b3ull; // separator, so ("ab", "c") and ("a", "bc") differ
+        }
+        return h;
+    }
+
+    std::string entry(std::string const& key, std::size_t index) const {
+        return (dir / (key + '.' + std::to_string(index))).string();
+    }
+
+public:
+    explicit output_cache(std::string const& _dir) : dir(_dir), lookups(0), hits(0) {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec) {
+            std::cerr << "failed to create cache directory '" << _dir << "': " << ec.message() << "\n";
+            throw std::runtime_error("cache: bad cache directory");
+        }
+    }
+
+    std::string key(std::string_view header_contents, headerfile const& hfile, codegen_options const& options) const {
+        static constexpr char hex[] = "0123456789abcdef";
+        std::uint64_t const h = hash({ generator_version, options.fingerprint(), hfile.filename, header_contents });
+        std::string key(16, '0');
+        for (int i = 15; i >= 0; --i)
+            key[i] = hex[(h >> (4 * (15 - i))) & 0xf];
+        return key + '-' + std::to_string(header_contents.size());
+    }
+
+    // copies the cached outputs to files (see generated_files()), returns false on a miss
+    bool restore(std::string const& key, std::vector<std::string> const& files) {
+        ++lookups;
+        std::vector<source_buffer> cached;
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            if (!cached.emplace_back(entry(key, i)).is_open())
+                return false;
+        }
+        for (std::size_t i = 0; i < files.size(); ++i)
+            write_if_changed(files[i], cached[i].view());
+        ++hits;
+        return true;
+    }
+
+    // saves the outputs cpptopy() just wrote
+    void store(std::string const& key, std::vector<std::string> const& files) {
+        std::vector<source_buffer> generated;
+        for (std::string const& file : files) {
+            if (!generated.emplace_back(file).is_open())
+                return;
+        }
+        for (std::size_t i = 0; i < files.size(); ++i)
+            write_if_changed(entry(key, i), generated[i].view());
+    }
+
+    std::size_t lookup_count() const { return lookups; }
+    std::size_t hit_count()    const { return hits; }
+};
+
+}
+#endif
@@ -0,0 +1,72 @@
+#ifndef P2_OUTPUTFILE_H
+#  define P2_OUTPUTFILE_H
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include "sourcebuffer.h"
+
+#if __has_include(<unistd.h>)
+#  include <unistd.h>
+#  define P2_PROCESS_ID() static_cast<unsigned long>(::getpid())
+#else
+#  define P2_PROCESS_ID() 0ul
+#endif
+
+namespace proj2 {
+
+// Compares size first, then a hash, then the bytes, so most changed files are told apart without a full compare
+inline bool file_has_contents(std::string const& path, std::string_view contents) {
+    std::error_code ec;
+    auto const size = std::filesystem::file_size(path, ec);
+    if (ec || size != contents.size())
+        return false;
+    source_buffer existing(path);
+    if (!existing.is_open())
+        return false;
+    std::hash<std::string_view> hash;
+    if (hash(existing.view()) != hash(contents))
+        return false;
+    return std::memcmp(existing.view().data(), contents.data(), contents.size()) == 0;
+}
+
+// Replaces path with contents unless it already holds exactly those bytes, so an unchanged generated
+// file keeps its mtime and doesn't trigger a rebuild. The new file is written next to the old one and
+// renamed over it, readers never see a half written file. Returns true if the file was (re)written.
+inline bool write_if_changed(std::string const& path, std::string_view contents) {
+    if (file_has_contents(path, contents))
+        return false;
+
+    static std::atomic<unsigned long> temp_counter = 0;
+    std::string const temp_path = path + ".p2tmp." + std::to_string(P2_PROCESS_ID()) + '.' + std::to_string(temp_counter++);
+    {
+        std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+        ofs.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        ofs.close();
+        if (!ofs) {
+            std::error_code ignored;
+            std::filesystem::remove(temp_path, ignored);
+            std::cerr << "failed to write '" << temp_path << "'\n";
+            throw std::runtime_error("cpptopy: failed to write '" + path + "'");
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::error_code ignored;
+        std::filesystem::remove(temp_path, ignored);
+        std::cerr << "failed to rename '" << temp_path << "' to '" << path << "': " << ec.message() << "\n";
+        throw std::runtime_error("cpptopy: failed to write '" + path + "'");
+    }
+    return true;
+}
+
+}
+#endif
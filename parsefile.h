@@ -26,7 +26,7 @@ struct ast_type_basic {
     bool        mod_ptr;
     bool        mod_ref;
     bool        mod_unsigned;
-    std::string custom_typename;
+    interned_string custom_typename;
 };
 
 struct ast_type_container {
@@ -40,13 +40,13 @@ struct ast_type_container {
 using ast_type = std::variant<ast_type_basic, ast_type_container>;
 
 struct ast_basic_variable {
-    ast_type_basic type;
-    std::string    name;
+    ast_type_basic  type;
+    interned_string name;
 };
 
 struct ast_container {
     ast_type_container type;
-    std::string        name;
+    interned_string    name;
 };
 
 using ast_variable = std::variant<ast_basic_variable, ast_container>;
@@ -55,17 +55,17 @@ struct ast_function {
     ast_type                  return_type;
     bool                      declaration_only;
     std::vector<ast_variable> params;
-    std::string               name;
+    interned_string           name;
 };
 
 struct ast_struct {
     std::vector<ast_variable> members; // no nested structs
-    std::string               name;
+    interned_string           name;
 };
 
 struct ast_include {
-    bool        is_sys_header; // <header> vs "header"
-    std::string name;
+    bool            is_sys_header; // <header> vs "header"
+    interned_string name;
 };
 
 using ast_node = std::variant<
@@ -116,16 +116,15 @@ inline std::ostream& operator<< (std::ostream& os, parser_scope ps) {
 }
 
 
-// Note: variants can't hold references, maybe reference_wrapper would be appropriate here?
-// Note2: calling this a "tag" might be a bit misleading, it is used for runtime dispatch but the value is also read (so value cant't simply be an empty struct tag type)
-// Note3: these raw pointers are non-owning (important given what Bjarne emphasized about pointer ownership/ C++ Core Guidelines I.11)
+// Note: calling this a "tag" might be a bit misleading, it is used for runtime dispatch but the value is also read (so value cant't simply be an empty struct tag type)
+// Note2: the typed token views are a string_view + enum, so the tag holds them by value (the string_views are non-owning, they point into the token_list's source)
 using token_tag = std::variant<
-    container_token  const*,
-    identifier_token const*,
-    keyword_token    const*,
-    modifier_token   const*,
-    symbol_token     const*,
-    type_token       const*>;
+    container_token,
+    identifier_token,
+    keyword_token,
+    modifier_token,
+    symbol_token,
+    type_token>;
 
 
 class parser {
@@ -136,45 +135,44 @@ struct parser_ast_visitor { // Note: doesn't inherit from ast_visitor_base becau
     parser_ast_visitor(parser& _my_parser) : my_parser(_my_parser) {}
 
     // Multiple dispatch with std::visit + 2 variants
-    void operator() (ast_basic_variable& node, identifier_token const* token) const;
-    void operator() (ast_basic_variable& node, modifier_token   const* token) const;
-    void operator() (ast_basic_variable& node, type_token       const* token) const;
+    void operator() (ast_basic_variable& node, identifier_token const& token) const;
+    void operator() (ast_basic_variable& node, modifier_token   const& token) const;
+    void operator() (ast_basic_variable& node, type_token       const& token) const;
 
-    void operator() (ast_container& node, container_token  const* token) const;
-    void operator() (ast_container& node, identifier_token const* token) const;
-    void operator() (ast_container& node, modifier_token   const* token) const;
-    void operator() (ast_container& node, type_token       const* token) const;
+    void operator() (ast_container& node, container_token  const& token) const;
+    void operator() (ast_container& node, identifier_token const& token) const;
+    void operator() (ast_container& node, modifier_token   const& token) const;
+    void operator() (ast_container& node, type_token       const& token) const;
 
-    // void operator() (ast_function& node, symbol_token const* token) const; // Not used
+    // void operator() (ast_function& node, symbol_token const& token) const; // Not used
 
-    void operator() (ast_include& node, identifier_token const* token) const;
-    void operator() (ast_include& node, symbol_token     const* token) const;
+    void operator() (ast_include& node, identifier_token const& token) const;
+    void operator() (ast_include& node, symbol_token     const& token) const;
 
-    void operator() (ast_struct& node, type_token       const* token) const;
+    void operator() (ast_struct& node, type_token       const& token) const;
 
     // Note: with c++20 can change this to operator() (auto&, auto&)
     template <typename Node, typename Token>
     void operator() (Node&, Token&) const {} // Default case, do nothing
 };
 
-struct parser_token_visitor : token_visitor_base {
-    // Note: lots of annoying boilerplate in this class, metaprogramming would be nice but virtuals can't be templated, hmm...
+struct parser_token_visitor { // Note: called through token_list::visit(), which switches on the token kind
     parser& my_parser;
     parser_token_visitor(parser& _my_parser) : my_parser(_my_parser) {}
 
-    void visit(container_token const& token) const override {
+    void operator() (container_token const& token) const {
         my_parser.set_current_token(token);
         my_parser += parser_scope::variable;
         my_parser.push_node<ast_container>();
         my_parser.update_node();
     }
 
-    void visit(identifier_token const& token) const override {
+    void operator() (identifier_token const& token) const {
         my_parser.set_current_token(token);
         my_parser.update_node();
     }
 
-    void visit(keyword_token const& token) const override {
+    void operator() (keyword_token const& token) const {
         my_parser.set_current_token(token);
         if (token.type == keyword_t::k_struct) {
             my_parser += parser_scope::struct_decl;
@@ -183,7 +181,7 @@ struct parser_token_visitor : token_visitor_base {
         my_parser.update_node();
     }
 
-    void visit(modifier_token const& token) const override {
+    void operator() (modifier_token const& token) const {
         my_parser.set_current_token(token);
         if (my_parser == parser_scope::struct_def    ||
             my_parser == parser_scope::function_decl ||
@@ -199,7 +197,7 @@ struct parser_token_visitor : token_visitor_base {
         my_parser.update_node();
     }
 
-    void visit(symbol_token const& token) const override {
+    void operator() (symbol_token const& token) const {
         my_parser.set_current_token(token);
         parser_scope prev_scope = parser_scope::unknown;
         switch (token.type) {
@@ -280,7 +278,7 @@ struct parser_token_visitor : token_visitor_base {
         my_parser.update_node();
     }
 
-    void visit(type_token const& token) const override {
+    void operator() (type_token const& token) const {
         my_parser.set_current_token(token);
         if (my_parser != parser_scope::struct_decl &&
             my_parser != parser_scope::variable) 
@@ -304,8 +302,8 @@ struct parser_token_visitor : token_visitor_base {
 
     void parse_tokens() {
         scope.push(parser_scope::global);
-        for (std::unique_ptr<base_token> const& token_ptr: *tokens) {
-            token_ptr->accept(my_token_visitor);
+        for (token const& tok: tokens->tokens) {
+            tokens->visit(my_token_visitor, tok);
         }
     }
 
@@ -366,7 +364,7 @@ struct parser_token_visitor : token_visitor_base {
 
     template <class Token> // TODO: enable if
     void set_current_token(Token const& token) {
-        current_token_tag = &token;
+        current_token_tag = token;
     }
 
     ast_node& current_node() {
@@ -494,12 +492,12 @@ public:
     }
 };
 
-void parser::parser_ast_visitor::operator() (ast_basic_variable& node, identifier_token const* token) const {
-    node.name = token->value;
+void parser::parser_ast_visitor::operator() (ast_basic_variable& node, identifier_token const& token) const {
+    node.name = token.name;
 }
 
-void parser::parser_ast_visitor::operator() (ast_basic_variable& node, modifier_token const* token) const {
-    switch (token->type) {
+void parser::parser_ast_visitor::operator() (ast_basic_variable& node, modifier_token const& token) const {
+    switch (token.type) {
         case modifier_t::m_const:
             node.type.mod_const = true;
             break;
@@ -518,23 +516,23 @@ void parser::parser_ast_visitor::operator() (ast_basic_variable& node, modifier_
     }
 }
 
-void parser::parser_ast_visitor::operator() (ast_basic_variable& node, type_token const* token) const {
-    node.type.type = token->type;
-    if (token->type == type_t::t_custom) {
-        node.type.custom_typename = token->value;
+void parser::parser_ast_visitor::operator() (ast_basic_variable& node, type_token const& token) const {
+    node.type.type = token.type;
+    if (token.type == type_t::t_custom) {
+        node.type.custom_typename = token.name;
     }
 }
 
-void parser::parser_ast_visitor::operator() (ast_container& node, container_token const* token) const {
-    node.type.type = token->type;
+void parser::parser_ast_visitor::operator() (ast_container& node, container_token const& token) const {
+    node.type.type = token.type;
 }
 
-void parser::parser_ast_visitor::operator() (ast_container& node, identifier_token const* token) const {
-    node.name = token->value;
+void parser::parser_ast_visitor::operator() (ast_container& node, identifier_token const& token) const {
+    node.name = token.name;
 }
 
-void parser::parser_ast_visitor::operator() (ast_container& node, modifier_token const* token) const {
-    switch (token->type) {
+void parser::parser_ast_visitor::operator() (ast_container& node, modifier_token const& token) const {
+    switch (token.type) {
         case modifier_t::m_const:
             node.type.mod_const = true;
             break;
@@ -550,24 +548,25 @@ void parser::parser_ast_visitor::operator() (ast_container& node, modifier_token
     }
 }
 
-void parser::parser_ast_visitor::operator() (ast_container& node, type_token const* token) const {
-    node.name = token->value;
+void parser::parser_ast_visitor::operator() (ast_container& node, type_token const& token) const {
+    node.name = token.name;
 }
 
-void parser::parser_ast_visitor::operator() (ast_include& node, identifier_token const* token) const {
-    node.name = token->value;
+void parser::parser_ast_visitor::operator() (ast_include& node, identifier_token const& token) const {
+    node.name = token.name;
 }
 
-void parser::parser_ast_visitor::operator() (ast_include& node, symbol_token const* token) const {
-    if (token->type == symbol_t::s_lt)
+void parser::parser_ast_visitor::operator() (ast_include& node, symbol_token const& token) const {
+    if (token.type == symbol_t::s_lt)
         node.is_sys_header = true;
 }
 
-void parser::parser_ast_visitor::operator() (ast_struct& node, type_token const* token) const {
-    node.name = token->value;
+void parser::parser_ast_visitor::operator() (ast_struct& node, type_token const& token) const {
+    node.name = token.name;
 }
 
 
+// Note: names in the ast are interned in tokens->symbols, keep the token_list alive while the ast is in use
 inline std::unique_ptr<ast> parse(std::unique_ptr<token_list> const& tokens) {
     parser my_parser(tokens);
     return my_parser.move_ast();
@@ -1,26 +1,226 @@
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "cpptopy.h"
+#include "executor.h"
+#include "outputcache.h"
 #include "parsefile.h"
+#include "scaffold.h"
+#include "sourcebuffer.h"
+#include "threadpool.h"
 #include "tokenizer.h"
 
 using namespace std;
 using namespace proj2;
 
+static void usage(char const* argv0) {
+    cerr << "usage: " << argv0 << " [--jobs <n>] [--codegen <shared|pool|inline>] [--backend <boostpython|capi>] [--cache-dir <dir>] [--shards <n>] [--buffer-protocol] [--release-gil <file>] [--std-hash] [--fast-calls] [--slots] [--pickle] [--scaffold <dir> [--unity]] [--from-list <file>] <path-to-header-file>...\n";
+}
+
+// a whole decimal number no smaller than min, e.g. --jobs 4
+static bool parse_count(char const* arg, size_t min, size_t& count) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long const value = isdigit(static_cast<unsigned char>(arg[0])) ? strtoul(arg, &end, 10) : 0;
+    if (end == nullptr || *end != '\0' || errno == ERANGE || value < min)
+        return false;
+    count = value;
+    return true;
+}
+
+// one entry per line, surrounding whitespace & blank lines are ignored
+static bool read_list_file(string const& listfile, vector<string>& entries) {
+    ifstream ifs(listfile);
+    if (!ifs.is_open()) {
+        cerr << "Failed to open file '" << listfile << "'\n";
+        return false;
+    }
+    string line;
+    while (getline(ifs, line)) {
+        auto const first = line.find_first_not_of(" \t\r");
+        if (first == string::npos)
+            continue;
+        auto const last = line.find_last_not_of(" \t\r");
+        entries.push_back(line.substr(first, last - first + 1));
+    }
+    return true;
+}
+
+static void process_header(string const& header, executor& codegen, codegen_options const& options, output_cache* cache, build_scaffold* scaffold) {
+    source_buffer source(header);
+    if (!source.is_open())
+        throw runtime_error("Failed to open file '" + header + "'");
+
+    // on a cache hit the header is never tokenized or parsed
+    headerfile hfile(header);
+    string key;
+    if (cache) {
+        key = cache->key(source.view(), hfile, options);
+        if (cache->restore(key, generated_files(hfile, options))) {
+            if (scaffold)
+                scaffold->add(hfile, options);
+            return;
+        }
+    }
+
+    auto tokens = tokenize(std::move(source));
+    auto parsed = parse(tokens);
+    cpptopy(header, parsed, tokens->symbols, codegen, options);
+
+    if (cache)
+        cache->store(key, generated_files(hfile, options));
+    if (scaffold)
+        scaffold->add(hfile, options);
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        cerr << "usage: " << argv[0] <<" <path-to-header-file>\n";
+    vector<string> headers;
+    size_t jobs = thread::hardware_concurrency();
+    string_view codegen_mode = "shared";
+    unique_ptr<output_cache> cache;
+    codegen_options options;
+    string scaffold_dir;
+    bool unity = false;
+    for (int i = 1; i < argc; ++i) {
+        string_view const arg = argv[i];
+        if ((arg == "--from-list" || arg == "--jobs" || arg == "--codegen" || arg == "--backend" || arg == "--cache-dir" || arg == "--shards" || arg == "--scaffold" || arg == "--release-gil") && i + 1 == argc) {
+            usage(argv[0]);
+            return 1;
+        } else if (arg == "--from-list") {
+            if (!read_list_file(argv[++i], headers))
+                return 1;
+        } else if (arg == "--jobs") {
+            if (!parse_count(argv[++i], 1, jobs)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--codegen") {
+            codegen_mode = argv[++i];
+            if (codegen_mode != "shared" && codegen_mode != "pool" && codegen_mode != "inline") {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--backend" || arg.substr(0, 10) == "--backend=") {
+            string_view const backend = arg == "--backend" ? string_view(argv[++i]) : arg.substr(10);
+            if (backend == "capi")
+                options.backend = codegen_backend::capi;
+            else if (backend == "boostpython")
+                options.backend = codegen_backend::boostpython;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--scaffold") {
+            scaffold_dir = argv[++i];
+        } else if (arg == "--release-gil") {
+            vector<string> functions;
+            if (!read_list_file(argv[++i], functions))
+                return 1;
+            options.release_gil.insert(functions.begin(), functions.end());
+        } else if (arg == "--std-hash") {
+            options.std_hash = true;
+        } else if (arg == "--fast-calls") {
+            options.fast_calls = true;
+        } else if (arg == "--slots") {
+            options.slots = true;
+        } else if (arg == "--pickle") {
+            options.pickle = true;
+        } else if (arg == "--buffer-protocol") {
+            options.buffer_protocol = true;
+        } else if (arg == "--unity") {
+            unity = true;
+        } else if (arg == "--shards") {
+            if (!parse_count(argv[++i], 0, options.shards)) { // 0 is the unsharded default
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--cache-dir") {
+            try {
+                cache = make_unique<output_cache>(argv[++i]);
+            } catch (exception const&) {
+                return 1;
+            }
+        } else {
+            headers.emplace_back(arg);
+        }
+    }
+    if (headers.empty() || (unity && scaffold_dir.empty())) {
+        usage(argv[0]);
         return 1;
     }
-
-    ifstream ifs(argv[1]);
-    if (!ifs.is_open()) {
-        cerr << "Failed to open file '" << argv[1] << "'\n";
+    if (options.backend == codegen_backend::capi && (options.shards != 0 || options.buffer_protocol || options.std_hash || options.fast_calls || options.slots || options.pickle)) {
+        cerr << "--shards, --buffer-protocol, --std-hash, --fast-calls, --slots & --pickle are only supported by the boostpython backend"
+             << " (the capi backend's classes always use typed getset descriptors without a __dict__)\n";
         return 1;
     }
 
-    auto tokens = tokenize(ifs);
-    auto parsed = parse(tokens); 
-    cpptopy(argv[1], parsed);
+    unique_ptr<build_scaffold> scaffold;
+    if (!scaffold_dir.empty()) {
+        try {
+            scaffold = make_unique<build_scaffold>(scaffold_dir, unity);
+        } catch (exception const&) {
+            return 1;
+        }
+    }
+
+    // one failed header is reported and the rest of the batch carries on
+    atomic<size_t> failures = 0;
+    {
+        thread_pool pool(min(jobs, headers.size()));
+
+        // where each header's .cpp & .py generation runs: the batch pool, a dedicated pool or the worker itself
+        unique_ptr<executor> codegen;
+        if (codegen_mode == "inline")
+            codegen = make_unique<inline_executor>();
+        else if (codegen_mode == "pool")
+            codegen = make_unique<thread_pool_executor>(jobs);
+        else
+            codegen = make_unique<shared_pool_executor>(pool);
+
+        task_group batch(pool);
+        for (string const& header : headers) {
+            batch.run([&header, &failures, &codegen, &options, &cache, &scaffold]{
+                try {
+                    process_header(header, *codegen, options, cache.get(), scaffold.get());
+                } catch (exception const& e) {
+                    ostringstream msg; // one write, so messages from different workers don't interleave
+                    msg << header << ": " << e.what() << '\n';
+                    cerr << msg.str();
+                    ++failures;
+                }
+            });
+        }
+        batch.wait();
+    }
+
+    // the headers that failed are left out
+    if (scaffold) {
+        try {
+            scaffold->write();
+        } catch (exception const& e) {
+            cerr << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    if (cache) {
+        size_t const lookups = cache->lookup_count();
+        size_t const hits    = cache->hit_count();
+        clog << "cache: " << hits << " of " << lookups << " headers restored ("
+             << (lookups ? 100 * hits / lookups : 0) << "% hit rate)\n";
+    }
 
+    if (failures != 0) {
+        cerr << failures << " of " << headers.size() << " headers failed\n";
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,173 @@
+#ifndef P2_SCAFFOLD_H
+#  define P2_SCAFFOLD_H
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include "cpptopy.h"
+#include "outputfile.h"
+#include "sourcebuffer.h"
+
+namespace proj2 {
+
+// Build files shared by every module of a batch, written to one directory:
+//   bindings_pch.h       boost python + the indexing suites any module includes (Python.h for the capi backend),
+//                        to be precompiled once
+//   bindings.mk          pch, object & one <module>.so target per header, run `make -f <dir>/bindings.mk`
+//                        from the directory proj2 ran in (the generated paths are relative to it)
+//   bindings_unity.cpp   optional, #includes every generated .cpp so the batch compiles as one TU,
+//                        used by bindings.mk when BINDINGS_UNITY=1 (headers need include guards for this)
+// Note: built from the generated .cpp files on disk, so headers restored from the cache are included too
+class build_scaffold {
+    static constexpr std::string_view map_suite_include    = "#include <boost/python/suite/indexing/map_indexing_suite.hpp>";
+    static constexpr std::string_view vector_suite_include = "#include <boost/python/suite/indexing/vector_indexing_suite.hpp>";
+
+    struct module {
+        std::string              name;    // e.g. examples/hard, the .so is built next to the header
+        std::vector<std::string> sources; // the module .cpp then its shards
+    };
+
+    std::filesystem::path dir;
+    bool                  unity;
+    std::mutex            mutex;   // guards the members below, modules are added from the batch workers
+    std::vector<module>   modules;
+    bool                  include_map_indexing_suite_hpp;
+    bool                  include_vector_indexing_suite_hpp;
+    bool                  boost_python; // false when every module uses the capi backend
+
+    // only the include block at the top of a generated file is searched
+    static std::string_view include_block(std::string_view cpp) {
+        auto const end = cpp.find("\n#include \"");
+        return cpp.substr(0, end);
+    }
+
+    std::string pch() const {
+        std::ostringstream out;
+        out << "// AUTO GENERATED BY PROJ2, python headers shared by every generated binding\n"
+            << "#ifndef P2_BINDINGS_PCH_H\n"
+            << "#  define P2_BINDINGS_PCH_H\n\n";
+        if (!boost_python) {
+            out << capi_includes
+                << "\n#endif\n";
+            return std::move(out).str();
+        }
+        out << "#include <boost/python.hpp>\n";
+        if (include_map_indexing_suite_hpp)
+            out << map_suite_include << '\n';
+        if (include_vector_indexing_suite_hpp)
+            out << vector_suite_include << '\n';
+        out << "\n#endif\n";
+        return std::move(out).str();
+    }
+
+    std::string unity_tu() const {
+        std::ostringstream out;
+        out << "// AUTO GENERATED BY PROJ2, every generated binding in one translation unit\n"
+            << "#include \"bindings_pch.h\"\n\n";
+        for (module const& m : modules) {
+            for (std::string const& source : m.sources)
+                out << "#include \"" << source << "\"\n";
+        }
+        return std::move(out).str();
+    }
+
+    std::string makefile() const {
+        std::string const pch_path = (dir / "bindings_pch.h").string();
+        std::ostringstream out;
+        out << "# AUTO GENERATED BY PROJ2\n"
+            << "BINDINGS_CXXFLAGS ?= -std=c++17 -Wall -O2 -fPIC -I. $(shell python3-config --includes)\n"
+            << "BINDINGS_LDLIBS   ?=" << (boost_python ? " -lboost_python3" : "") << "\n"
+            << "BINDINGS_PCH      := " << pch_path << "\n"
+            << "BINDINGS_MODULES  :=";
+        for (module const& m : modules)
+            out << ' ' << m.name << ".so";
+        out << "\n\n"
+            << ".PHONY: bindings bindings_clean\n"
+            << "bindings: $(BINDINGS_MODULES)\n\n"
+            << "$(BINDINGS_PCH).gch: $(BINDINGS_PCH)\n"
+            << "\t$(CXX) $(BINDINGS_CXXFLAGS) -x c++-header $< -o $@\n\n"
+            << "%.o: %.cpp $(BINDINGS_PCH).gch\n"
+            << "\t$(CXX) $(BINDINGS_CXXFLAGS) -include $(BINDINGS_PCH) -c $< -o $@\n\n";
+        if (unity) {
+            std::string const unity_path = (dir / "bindings_unity").string();
+            out << "ifeq ($(BINDINGS_UNITY),1)\n"
+                << "$(BINDINGS_MODULES): " << unity_path << ".o\n"
+                << "\t$(CXX) -shared $< -o $@ $(BINDINGS_LDLIBS)\n"
+                << "else\n";
+        }
+        for (module const& m : modules) {
+            out << m.name << ".so:";
+            for (std::string const& source : m.sources)
+                out << ' ' << std::string_view(source).substr(0, source.size() - 4) << ".o";
+            out << "\n\t$(CXX) -shared $^ -o $@ $(BINDINGS_LDLIBS)\n";
+        }
+        if (unity)
+            out << "endif\n";
+        out << "\nbindings_clean:\n"
+            << "\trm -f $(BINDINGS_MODULES) $(BINDINGS_PCH).gch";
+        if (unity)
+            out << ' ' << (dir / "bindings_unity.o").string();
+        for (module const& m : modules) {
+            for (std::string const& source : m.sources)
+                out << ' ' << std::string_view(source).substr(0, source.size() - 4) << ".o";
+        }
+        out << '\n';
+        return std::move(out).str();
+    }
+
+public:
+    build_scaffold(std::string const& _dir, bool _unity) :
+        dir(_dir), unity(_unity), mutex(), modules(),
+        include_map_indexing_suite_hpp(false), include_vector_indexing_suite_hpp(false), boost_python(false) {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec) {
+            std::cerr << "failed to create scaffold directory '" << _dir << "': " << ec.message() << "\n";
+            throw std::runtime_error("scaffold: bad scaffold directory");
+        }
+    }
+
+    // call once the header's outputs have been generated or restored
+    void add(headerfile const& hfile, codegen_options const& options) {
+        module m;
+        m.name = std::filesystem::path(hfile.cppfile).replace_extension().string();
+        for (std::string& file : generated_files(hfile, options)) {
+            if (std::string_view(file).substr(file.size() - 4) == ".cpp")
+                m.sources.push_back(std::move(file));
+        }
+
+        source_buffer cpp(hfile.cppfile);
+        std::string_view const includes = include_block(cpp.view());
+        bool const uses_map_suite    = includes.find(map_suite_include)    != std::string_view::npos;
+        bool const uses_vector_suite = includes.find(vector_suite_include) != std::string_view::npos;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        modules.push_back(std::move(m));
+        include_map_indexing_suite_hpp    |= uses_map_suite;
+        include_vector_indexing_suite_hpp |= uses_vector_suite;
+        boost_python                      |= options.backend == codegen_backend::boostpython;
+    }
+
+    // Note: modules are sorted so the files don't depend on which worker finished first,
+    // write_if_changed() then leaves them (and the precompiled header) alone between identical runs
+    void write() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::sort(modules.begin(), modules.end(), [](module const& lhs, module const& rhs){ return lhs.name < rhs.name; });
+        modules.erase(std::unique(modules.begin(), modules.end(),
+            [](module const& lhs, module const& rhs){ return lhs.name == rhs.name; }), modules.end());
+        write_if_changed((dir / "bindings_pch.h").string(), pch());
+        write_if_changed((dir / "bindings.mk").string(), makefile());
+        if (unity)
+            write_if_changed((dir / "bindings_unity.cpp").string(), unity_tu());
+    }
+};
+
+}
+#endif
@@ -0,0 +1,141 @@
+#ifndef P2_SOURCEBUFFER_H
+#  define P2_SOURCEBUFFER_H
+
+#include <cstddef>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if __has_include(<sys/mman.h>)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#  define P2_HAVE_MMAP 1
+#else
+#  define P2_HAVE_MMAP 0
+#endif
+
+namespace proj2 {
+
+// Contiguous read-only view of a whole header file, so the tokenizer can scan raw memory.
+// The file is mmap'd when the platform supports it, otherwise it is read in one bulk read.
+class source_buffer {
+    std::string      storage; // bulk read fallback
+    void*            mapping;
+    std::size_t      mapping_size;
+    std::string_view contents;
+    bool             opened;
+
+    bool map_file(std::string const& path) {
+#if P2_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+        if (st.st_size == 0) { // mmap refuses empty files
+            ::close(fd);
+            opened = true;
+            return true;
+        }
+        void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps its own reference to the file
+        if (addr == MAP_FAILED)
+            return false;
+        ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        mapping      = addr;
+        mapping_size = st.st_size;
+        contents     = std::string_view(static_cast<char const*>(addr), mapping_size);
+        opened       = true;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void read_stream(std::istream& is) {
+        is.seekg(0, std::ios::end);
+        auto const size = is.tellg();
+        if (size >= 0) {
+            is.seekg(0, std::ios::beg);
+            storage.resize(static_cast<std::size_t>(size));
+            is.read(storage.data(), size);
+            storage.resize(static_cast<std::size_t>(is.gcount()));
+        } else { // not seekable, let the streambuf do the bulk copy
+            is.clear();
+            std::ostringstream oss;
+            oss << is.rdbuf();
+            storage = std::move(oss).str();
+        }
+        contents = storage;
+        opened   = true;
+    }
+
+    void unmap() noexcept {
+#if P2_HAVE_MMAP
+        if (mapping != nullptr)
+            ::munmap(mapping, mapping_size);
+#endif
+        mapping      = nullptr;
+        mapping_size = 0;
+    }
+
+public:
+    source_buffer() :
+        storage(), mapping(nullptr), mapping_size(0), contents(), opened(false) {}
+
+    explicit source_buffer(std::string const& path) :
+        storage(), mapping(nullptr), mapping_size(0), contents(), opened(false) {
+        if (!map_file(path)) {
+            std::ifstream ifs(path, std::ios::binary);
+            if (ifs.is_open())
+                read_stream(ifs);
+        }
+    }
+
+    explicit source_buffer(std::istream& is) :
+        storage(), mapping(nullptr), mapping_size(0), contents(), opened(false) {
+        read_stream(is);
+    }
+
+    source_buffer(source_buffer&& other) noexcept :
+        storage(std::move(other.storage)),
+        mapping(std::exchange(other.mapping, nullptr)),
+        mapping_size(std::exchange(other.mapping_size, 0)),
+        contents(mapping != nullptr ? other.contents : std::string_view(storage)), // moved strings may be SSO, so re-point at our copy
+        opened(std::exchange(other.opened, false)) {
+        other.contents = std::string_view();
+    }
+
+    source_buffer& operator=(source_buffer&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            storage        = std::move(other.storage);
+            mapping        = std::exchange(other.mapping, nullptr);
+            mapping_size   = std::exchange(other.mapping_size, 0);
+            contents       = mapping != nullptr ? other.contents : std::string_view(storage);
+            opened         = std::exchange(other.opened, false);
+            other.contents = std::string_view();
+        }
+        return *this;
+    }
+
+    source_buffer(source_buffer const&) = delete;
+    source_buffer& operator=(source_buffer const&) = delete;
+
+    ~source_buffer() { unmap(); }
+
+    bool             is_open()   const { return opened; }
+    bool             is_mapped() const { return mapping != nullptr; }
+    std::string_view view()      const { return contents; }
+};
+
+}
+#endif
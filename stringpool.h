@@ -0,0 +1,74 @@
+#ifndef P2_STRINGPOOL_H
+#  define P2_STRINGPOOL_H
+
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace proj2 {
+
+using string_id = std::uint32_t;
+
+// A spelling interned in a string_pool, equality is an id compare
+struct interned_string {
+    string_id        id       = 0; // 0 is always the empty string
+    std::string_view spelling = {};
+
+    bool empty() const noexcept { return id == 0; }
+    operator std::string_view() const noexcept { return spelling; }
+};
+
+inline bool operator==(interned_string const lhs, interned_string const rhs) noexcept { return lhs.id == rhs.id; }
+inline bool operator!=(interned_string const lhs, interned_string const rhs) noexcept { return lhs.id != rhs.id; }
+
+inline std::ostream& operator<< (std::ostream& os, interned_string const str) {
+    return os << str.spelling;
+}
+
+// One id per distinct spelling, shared by the tokenizer, parser and code generators of one header.
+// Note: not thread safe, each header gets its own pool
+class string_pool {
+    std::deque<std::string>                         owned;     // copies made by intern_copy(), deque never moves them
+    std::vector<std::string_view>                   spellings; // indexed by string_id
+    std::unordered_map<std::string_view, string_id> ids;
+
+public:
+    string_pool() : owned(), spellings(), ids() {
+        spellings.emplace_back();
+        ids.emplace(std::string_view(), 0);
+    }
+
+    string_pool(string_pool const&) = delete;
+    string_pool& operator=(string_pool const&) = delete;
+
+    // spelling must outlive the pool (e.g. it points into the token_list's source buffer)
+    interned_string intern(std::string_view spelling) {
+        auto const [it, inserted] = ids.try_emplace(spelling, static_cast<string_id>(spellings.size()));
+        if (inserted)
+            spellings.push_back(spelling);
+        return { it->second, it->first };
+    }
+
+    // for spellings built on the fly, the pool keeps its own copy
+    interned_string intern_copy(std::string_view spelling) {
+        if (auto it = ids.find(spelling); it != ids.end())
+            return { it->second, it->first };
+        return intern(owned.emplace_back(spelling));
+    }
+
+    interned_string operator[](string_id id) const { return { id, spellings[id] }; }
+
+    std::size_t size() const { return spellings.size(); }
+
+    void reserve(std::size_t count) {
+        spellings.reserve(count);
+        ids.reserve(count);
+    }
+};
+
+}
+#endif
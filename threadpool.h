@@ -0,0 +1,204 @@
+#ifndef P2_THREADPOOL_H
+#  define P2_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace proj2 {
+
+// Fixed-size work-stealing thread pool. Each worker has its own deque: it pushes & pops its own
+// work at the back and steals from the front of the others when it runs dry.
+class thread_pool {
+    struct queued_task {
+        std::function<void()> run;
+        void const*           owner; // the task_group it was submitted for, nullptr if none
+    };
+
+    struct worker_queue {
+        std::mutex              mutex;
+        std::deque<queued_task> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread>                   workers;
+    std::mutex                                 sleep_mutex;
+    std::condition_variable                    sleep_cv;
+    std::atomic<std::size_t>                   queued;     // submitted but not yet started
+    std::atomic<std::size_t>                   next_queue; // round robin for submits from outside the pool
+    bool                                       stopping;   // guarded by sleep_mutex
+
+    inline static thread_local thread_pool* current_pool  = nullptr;
+    inline static thread_local std::size_t  current_index = 0;
+
+    // any task when owner is nullptr, otherwise only one of owner's
+    bool pop_task(std::size_t index, std::function<void()>& task, void const* owner = nullptr) {
+        auto matches = [owner](queued_task const& entry){ return owner == nullptr || entry.owner == owner; };
+        worker_queue& own = *queues[index];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            auto const found = std::find_if(own.tasks.rbegin(), own.tasks.rend(), matches);
+            if (found != own.tasks.rend()) {
+                task = std::move(found->run);
+                own.tasks.erase(std::next(found).base());
+                --queued;
+                return true;
+            }
+        }
+        for (std::size_t i = 1; i < queues.size(); ++i) {
+            worker_queue& victim = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            auto const found = std::find_if(victim.tasks.begin(), victim.tasks.end(), matches);
+            if (found != victim.tasks.end()) {
+                task = std::move(found->run);
+                victim.tasks.erase(found);
+                --queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(std::size_t index) {
+        current_pool  = this;
+        current_index = index;
+        std::function<void()> task;
+        while (true) {
+            if (pop_task(index, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleep_cv.wait(lock, [this]{ return stopping || queued.load() != 0; });
+            if (stopping && queued.load() == 0)
+                return;
+        }
+    }
+
+public:
+    explicit thread_pool(std::size_t thread_count = std::thread::hardware_concurrency()) :
+        queues(), workers(), sleep_mutex(), sleep_cv(), queued(0), next_queue(0), stopping(false) {
+        thread_count = std::max<std::size_t>(thread_count, 1);
+        for (std::size_t i = 0; i < thread_count; ++i)
+            queues.push_back(std::make_unique<worker_queue>());
+        for (std::size_t i = 0; i < thread_count; ++i)
+            workers.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    // runs whatever is still queued, then joins the workers
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        sleep_cv.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    // owner tags the task for run_pending_task(), see task_group
+    void submit(std::function<void()> task, void const* owner = nullptr) {
+        std::size_t const index = current_pool == this
+            ? current_index
+            : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back({ std::move(task), owner });
+            ++queued;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex); // don't lose the wakeup of a worker about to sleep
+        }
+        sleep_cv.notify_one();
+    }
+
+    // Lets a thread that is waiting on owner's tasks run one of them instead of blocking.
+    // Returns false if none is queued.
+    // Note: only owner's tasks, running any queued task would nest unrelated work (e.g. whole other headers
+    // of a batch) on the waiting thread's stack without bound
+    bool run_pending_task(void const* owner) {
+        std::function<void()> task;
+        std::size_t const index = current_pool == this ? current_index : 0;
+        if (!pop_task(index, task, owner))
+            return false;
+        task();
+        return true;
+    }
+
+    std::size_t size() const { return workers.size(); }
+};
+
+// Tracks a set of tasks submitted to a thread_pool. wait() helps run the group's own queued tasks,
+// so it is safe to call from inside a pool worker. The first exception thrown by a task is rethrown by wait().
+class task_group {
+    thread_pool&            pool;
+    std::mutex              mutex;
+    std::condition_variable done_cv;
+    std::size_t             outstanding; // guarded by mutex
+    std::exception_ptr      first_error; // guarded by mutex
+
+    void task_finished(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error && !first_error)
+            first_error = error;
+        if (--outstanding == 0)
+            done_cv.notify_all();
+    }
+
+public:
+    explicit task_group(thread_pool& _pool) :
+        pool(_pool), mutex(), done_cv(), outstanding(0), first_error() {}
+
+    task_group(task_group const&) = delete;
+    task_group& operator=(task_group const&) = delete;
+
+    ~task_group() {
+        try { wait(); } catch (...) {} // never leave tasks pointing at a dead group
+    }
+
+    void run(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++outstanding;
+        }
+        pool.submit([this, task = std::move(task)]{
+            std::exception_ptr error;
+            try { task(); } catch (...) { error = std::current_exception(); }
+            task_finished(error);
+        }, this);
+    }
+
+    void wait() {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (outstanding == 0)
+                    break;
+            }
+            if (!pool.run_pending_task(this)) { // the rest are running elsewhere, sleep until they are done
+                std::unique_lock<std::mutex> lock(mutex);
+                done_cv.wait(lock, [this]{ return outstanding == 0; });
+                break;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (first_error)
+            std::rethrow_exception(std::exchange(first_error, nullptr));
+    }
+};
+
+}
+#endif
@@ -1,16 +1,29 @@
 #ifndef P2_TOKENIZER_H
 #  define P2_TOKENIZER_H
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
-#include <set>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <utility>
 #include "ctre.hpp"
+#include "sourcebuffer.h"
+#include "stringpool.h"
+
+#if !defined(P2_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#  include <immintrin.h>
+#  define P2_SIMD_X86 1
+#else
+#  define P2_SIMD_X86 0
+#endif
 
 namespace proj2 {
 
@@ -25,273 +38,527 @@ constexpr auto match_isspace    (std::string_view sv) noexcept { return ctre::ma
 constexpr auto match_keyword    (std::string_view sv) noexcept { return ctre::match<keyword_regex>(sv); }
 constexpr auto match_symbol     (std::string_view sv) noexcept { return ctre::match<symbol_regex>(sv); }
 
-enum class container_t  { c_unknown, c_vector, c_map, c_tuple };
-enum class keyword_t    { k_unknown, k_struct, k_inline, k_include };
-enum class modifier_t   { m_unknown, m_const, m_ptr, m_ref, m_unsigned };
-enum class symbol_t     { s_unknown, s_quot, s_comma, s_lpar, s_rpar, s_lcub, s_rcub, s_semi, s_pound, s_lt, s_gt};
-enum class type_t       { t_unknown, t_custom, t_int, t_long, t_short, t_double, t_float, t_char, t_void, t_string };
-
-// forward declarations
-struct container_token;
-struct identifier_token;
-struct keyword_token;
-struct modifier_token;
-struct symbol_token;
-struct type_token;
-
-struct token_visitor_base {
-    virtual void visit(container_token  const& token) const = 0;
-    virtual void visit(identifier_token const& token) const = 0;
-    virtual void visit(keyword_token    const& token) const = 0;
-    virtual void visit(modifier_token   const& token) const = 0;
-    virtual void visit(symbol_token     const& token) const = 0;
-    virtual void visit(type_token       const& token) const = 0;
-};
+enum class container_t  : std::uint8_t { c_unknown, c_vector, c_map, c_tuple };
+enum class keyword_t    : std::uint8_t { k_unknown, k_struct, k_inline, k_include };
+enum class modifier_t   : std::uint8_t { m_unknown, m_const, m_ptr, m_ref, m_unsigned };
+enum class symbol_t     : std::uint8_t { s_unknown, s_quot, s_comma, s_lpar, s_rpar, s_lcub, s_rcub, s_semi, s_pound, s_lt, s_gt};
+enum class type_t       : std::uint8_t { t_unknown, t_custom, t_int, t_long, t_short, t_double, t_float, t_char, t_void, t_string };
 
-struct base_token {
-    const std::string value;
-    base_token(std::string&& _value) : value(std::move(_value)) {}
-    base_token(char _value)          : value{_value}            {}
-    virtual ~base_token() = default;
-    virtual void accept(token_visitor_base const& tv) = 0;
-};
+enum class char_class_t  { cc_other, cc_space, cc_symbol };
 
-struct container_token : base_token {
-    const container_t type;
-    container_token(std::string&& _value, container_t _type) : base_token(std::move(_value)), type(_type) {}
-    virtual void accept(token_visitor_base const& tv) override { tv.visit(*this); }
+struct char_class_entry {
+    char_class_t cls;
+    symbol_t     symbol;   // set for cc_symbol punctuation
+    modifier_t   modifier; // set for cc_symbol '*' & '&', which are lexed as modifiers
 };
 
-struct identifier_token : base_token {
-    identifier_token(std::string&& _value) : base_token(std::move(_value)) {}
-    virtual void accept(token_visitor_base const& tv) override { tv.visit(*this); }
-};
+constexpr std::array<char_class_entry, 256> make_char_class_table() {
+    std::array<char_class_entry, 256> table{};
+    for (auto& entry : table)
+        entry = { char_class_t::cc_other, symbol_t::s_unknown, modifier_t::m_unknown };
+    for (unsigned char ch : { ' ', '\t', '\n', '\v', '\f', '\r' }) // same set as ctre's \s
+        table[ch].cls = char_class_t::cc_space;
+    auto const set_symbol = [&table](unsigned char ch, symbol_t s_type) {
+        table[ch] = { char_class_t::cc_symbol, s_type, modifier_t::m_unknown };
+    };
+    set_symbol('"', symbol_t::s_quot);
+    set_symbol(',', symbol_t::s_comma);
+    set_symbol('(', symbol_t::s_lpar);
+    set_symbol(')', symbol_t::s_rpar);
+    set_symbol('{', symbol_t::s_lcub);
+    set_symbol('}', symbol_t::s_rcub);
+    set_symbol(';', symbol_t::s_semi);
+    set_symbol('#', symbol_t::s_pound);
+    set_symbol('<', symbol_t::s_lt);
+    set_symbol('>', symbol_t::s_gt);
+    table[static_cast<unsigned char>('*')] = { char_class_t::cc_symbol, symbol_t::s_unknown, modifier_t::m_ptr };
+    table[static_cast<unsigned char>('&')] = { char_class_t::cc_symbol, symbol_t::s_unknown, modifier_t::m_ref };
+    return table;
+}
 
-struct keyword_token : base_token {
-    const keyword_t type;
-    keyword_token(std::string&& _value, keyword_t _type) : base_token(std::move(_value)), type(_type) {}
-    virtual void accept(token_visitor_base const& tv) override { tv.visit(*this); }
-};
+// one lookup per input byte instead of two regex matches + a capture search
+inline constexpr std::array<char_class_entry, 256> char_class_table = make_char_class_table();
 
-struct modifier_token : base_token {
-    const modifier_t type;
-    modifier_token(std::string&& _value, modifier_t _type) : base_token(std::move(_value)), type(_type) {}
-    modifier_token(char          _value, modifier_t _type) : base_token(_value           ), type(_type) {}
-    virtual void accept(token_visitor_base const& tv) override { tv.visit(*this); }
-};
+constexpr char_class_entry const& classify(char ch) noexcept {
+    return char_class_table[static_cast<unsigned char>(ch)];
+}
 
-struct symbol_token : base_token {
-    const symbol_t type;
-    symbol_token(std::string&& _value, symbol_t _type) : base_token(std::move(_value)), type(_type) {}
-    symbol_token(char _value         , symbol_t _type) : base_token(_value           ), type(_type) {}
-    virtual void accept(token_visitor_base const& tv) override { tv.visit(*this); }
-};
+// 1-based index of the first of captures 1..N that matched, 0 if none did
+template <typename Result, std::size_t... Is>
+constexpr int matched_capture(Result const& regex_matches, std::index_sequence<Is...>) {
+    int which = 0;
+    ((which = (which == 0 && regex_matches.template get<Is + 1>()) ? static_cast<int>(Is + 1) : which), ...);
+    return which;
+}
 
-struct type_token : base_token {
-    const type_t type;
-    type_token(std::string&& _value, type_t _type) : base_token(std::move(_value)), type(_type) {}
-    virtual void accept(token_visitor_base const& tv) override { tv.visit(*this); }
-};
+// The regexes above are the reference definition of the lexer's character classes,
+// check the table against them for every byte at compile time.
+constexpr bool char_class_table_matches_regex() {
+    for (int i = 0; i < 256; ++i) {
+        char const ch = static_cast<char>(i);
+        std::string_view const ch_str(&ch, 1);
+        char_class_entry const& entry = classify(ch);
+        auto const symbol_match = match_symbol(ch_str);
+        if (static_cast<bool>(match_isspace(ch_str)) != (entry.cls == char_class_t::cc_space))
+            return false;
+        if (static_cast<bool>(symbol_match) != (entry.cls == char_class_t::cc_symbol))
+            return false;
+        if (symbol_match) {
+            // captures 1-10 are in symbol_t order, 11 & 12 are '*' & '&'
+            int const which = matched_capture(symbol_match, std::make_index_sequence<12>{});
+            int const expected = entry.modifier == modifier_t::m_ptr ? 11
+                               : entry.modifier == modifier_t::m_ref ? 12
+                               : static_cast<int>(entry.symbol);
+            if (which != expected)
+                return false;
+        }
+    }
+    return true;
+}
+static_assert(char_class_table_matches_regex(), "char_class_table disagrees with isspace_regex/symbol_regex");
+
+// Run scanning: most input bytes are inside identifier runs, whitespace runs or ignored function bodies,
+// so the tokenizer skips to the end of a run 16/32 bytes at a time instead of looking at each byte.
+enum class scan_run_t { sr_token, sr_space, sr_body };
+
+// the symbols the SIMD kernels compare against, must agree with char_class_table
+inline constexpr char symbol_chars[] = { '"', ',', '(', ')', '{', '}', ';', '#', '<', '>', '*', '&' };
+
+constexpr bool symbol_chars_match_table() {
+    int symbols_in_table = 0;
+    for (auto const& entry : char_class_table)
+        symbols_in_table += entry.cls == char_class_t::cc_symbol;
+    for (char ch : symbol_chars) {
+        if (classify(ch).cls != char_class_t::cc_symbol)
+            return false;
+    }
+    return symbols_in_table == static_cast<int>(std::size(symbol_chars));
+}
+static_assert(symbol_chars_match_table(), "symbol_chars disagrees with char_class_table");
+
+template <scan_run_t Run>
+constexpr bool ends_run(char ch) noexcept {
+    if constexpr (Run == scan_run_t::sr_token)
+        return classify(ch).cls != char_class_t::cc_other;
+    else if constexpr (Run == scan_run_t::sr_space)
+        return classify(ch).cls != char_class_t::cc_space;
+    else
+        return ch == '{' || ch == '}';
+}
+
+template <scan_run_t Run>
+inline char const* scan_run_scalar(char const* first, char const* last) noexcept {
+    while (first != last && !ends_run<Run>(*first))
+        ++first;
+    return first;
+}
+
+#if P2_SIMD_X86
+// Note: lambdas don't inherit the target attribute, so the avx2 helpers are spelled out separately
 
-using token_list = std::vector<std::unique_ptr<base_token>>;
+// lanes are set where the byte is in the class (space: ' ' or '\t'..'\r')
+inline __m128i space_mask_sse2(__m128i bytes) noexcept {
+    __m128i const off = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    return _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                        _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8('\r' - '\t')), off));
+}
 
-inline void token_list_push_container(std::unique_ptr<token_list>& my_tokens, std::string& token, container_t const c_type) {
-    my_tokens->emplace_back(std::make_unique<container_token>(std::move(token), c_type));
+inline __m128i symbol_mask_sse2(__m128i bytes) noexcept {
+    __m128i mask = _mm_setzero_si128();
+    for (char ch : symbol_chars)
+        mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(ch)));
+    return mask;
 }
 
-inline void token_list_push_identifier(std::unique_ptr<token_list>& my_tokens, std::string& token) {
-    my_tokens->emplace_back(std::make_unique<identifier_token>(std::move(token)));
+template <scan_run_t Run>
+inline char const* scan_run_sse2(char const* first, char const* last) noexcept {
+    for (; last - first >= 16; first += 16) {
+        __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+        unsigned mask;
+        if constexpr (Run == scan_run_t::sr_token)
+            mask = _mm_movemask_epi8(_mm_or_si128(space_mask_sse2(bytes), symbol_mask_sse2(bytes)));
+        else if constexpr (Run == scan_run_t::sr_space)
+            mask = ~_mm_movemask_epi8(space_mask_sse2(bytes)) & 0xffffu;
+        else
+            mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('{')),
+                                                  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('}'))));
+        if (mask != 0)
+            return first + __builtin_ctz(mask);
+    }
+    return scan_run_scalar<Run>(first, last);
 }
 
-inline void token_list_push_keyword(std::unique_ptr<token_list>& my_tokens, std::string& token, keyword_t const k_type) {
-    my_tokens->emplace_back(std::make_unique<keyword_token>(std::move(token), k_type));
+__attribute__((target("avx2")))
+inline __m256i space_mask_avx2(__m256i bytes) noexcept {
+    __m256i const off = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+    return _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                           _mm256_cmpeq_epi8(_mm256_min_epu8(off, _mm256_set1_epi8('\r' - '\t')), off));
 }
 
-inline void token_list_push_modifier(std::unique_ptr<token_list>& my_tokens, std::string& token, modifier_t const m_type) {
-    my_tokens->emplace_back(std::make_unique<modifier_token>(std::move(token), m_type));
+__attribute__((target("avx2")))
+inline __m256i symbol_mask_avx2(__m256i bytes) noexcept {
+    __m256i mask = _mm256_setzero_si256();
+    for (char ch : symbol_chars)
+        mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(ch)));
+    return mask;
 }
 
-inline void token_list_push_modifier(std::unique_ptr<token_list>& my_tokens, char token, modifier_t const m_type) {
-    my_tokens->emplace_back(std::make_unique<modifier_token>(token, m_type));
+template <scan_run_t Run>
+__attribute__((target("avx2")))
+inline char const* scan_run_avx2(char const* first, char const* last) noexcept {
+    for (; last - first >= 32; first += 32) {
+        __m256i const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+        unsigned mask;
+        if constexpr (Run == scan_run_t::sr_token)
+            mask = _mm256_movemask_epi8(_mm256_or_si256(space_mask_avx2(bytes), symbol_mask_avx2(bytes)));
+        else if constexpr (Run == scan_run_t::sr_space)
+            mask = ~static_cast<unsigned>(_mm256_movemask_epi8(space_mask_avx2(bytes)));
+        else
+            mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('{')),
+                                                        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('}'))));
+        if (mask != 0)
+            return first + __builtin_ctz(mask);
+    }
+    return scan_run_sse2<Run>(first, last);
 }
+#endif
 
-inline void token_list_push_symbol(std::unique_ptr<token_list>& my_tokens, char token, symbol_t const s_type) {
-    my_tokens->emplace_back(std::make_unique<symbol_token>(token, s_type));
+struct scan_kernels {
+    using kernel = char const* (*)(char const*, char const*) noexcept;
+    kernel token_end; // first byte that isn't part of an identifier/keyword
+    kernel space_end; // first byte that isn't whitespace
+    kernel body_brace; // next '{' or '}' inside a function definition
+};
+
+// picked once per process from the running cpu, define P2_NO_SIMD to force the scalar kernels
+inline scan_kernels const& select_scan_kernels() noexcept {
+#if P2_SIMD_X86
+    static scan_kernels const kernels = __builtin_cpu_supports("avx2")
+        ? scan_kernels{ scan_run_avx2<scan_run_t::sr_token>, scan_run_avx2<scan_run_t::sr_space>, scan_run_avx2<scan_run_t::sr_body> }
+        : scan_kernels{ scan_run_sse2<scan_run_t::sr_token>, scan_run_sse2<scan_run_t::sr_space>, scan_run_sse2<scan_run_t::sr_body> };
+#else
+    static scan_kernels const kernels =
+        scan_kernels{ scan_run_scalar<scan_run_t::sr_token>, scan_run_scalar<scan_run_t::sr_space>, scan_run_scalar<scan_run_t::sr_body> };
+#endif
+    return kernels;
 }
 
-inline void token_list_push_type(std::unique_ptr<token_list>& my_tokens, std::string& token, type_t const t_type) {
-    my_tokens->emplace_back(std::make_unique<type_token>(std::move(token), t_type));
+enum class token_kind   : std::uint8_t { tk_container, tk_identifier, tk_keyword, tk_modifier, tk_symbol, tk_type };
+
+// Flat token record, the spelling is a slice of the token_list's source
+struct token {
+    token_kind    kind;
+    std::uint8_t  subtype; // container_t, keyword_t, modifier_t, symbol_t or type_t depending on kind
+    std::uint32_t offset;
+    std::uint32_t length;
+    string_id     id;      // interned spelling of identifiers & types, 0 otherwise
+};
+// the token vector is scanned by the parser in order, keep the record at 16 bytes (12 before the interned id)
+static_assert(sizeof(token) == 16, "token record grew, check the parser's scanning cost");
+
+// Typed views of a token, built on the fly when the parser dispatches on token::kind
+struct container_token  { std::string_view value; container_t type;                       };
+struct identifier_token { std::string_view value;                   interned_string name; };
+struct keyword_token    { std::string_view value; keyword_t   type;                       };
+struct modifier_token   { std::string_view value; modifier_t  type;                       };
+struct symbol_token     { std::string_view value; symbol_t    type;                       };
+struct type_token       { std::string_view value; type_t      type; interned_string name; };
+
+// Keyword recognition: a perfect hash over (length, first, middle, last char) picks the only candidate
+// keyword, then one string compare confirms it. To add a keyword, add its enum value and a row below,
+// the seed search reruns at compile time and lookups stay a hash + one compare however many keywords there are.
+struct keyword_entry {
+    std::string_view spelling;
+    token_kind       kind;
+    std::uint8_t     subtype;
+
+    constexpr keyword_entry(std::string_view _spelling, keyword_t   _type) : spelling(_spelling), kind(token_kind::tk_keyword  ), subtype(static_cast<std::uint8_t>(_type)) {}
+    constexpr keyword_entry(std::string_view _spelling, type_t      _type) : spelling(_spelling), kind(token_kind::tk_type     ), subtype(static_cast<std::uint8_t>(_type)) {}
+    constexpr keyword_entry(std::string_view _spelling, container_t _type) : spelling(_spelling), kind(token_kind::tk_container), subtype(static_cast<std::uint8_t>(_type)) {}
+    constexpr keyword_entry(std::string_view _spelling, modifier_t  _type) : spelling(_spelling), kind(token_kind::tk_modifier ), subtype(static_cast<std::uint8_t>(_type)) {}
+};
+
+// same order as the keyword_regex captures
+inline constexpr keyword_entry keywords[] = {
+    { "struct",      keyword_t::k_struct     }, // keywords
+    { "inline",      keyword_t::k_inline     },
+    { "include",     keyword_t::k_include    },
+    { "int",         type_t::t_int           }, // types
+    { "long",        type_t::t_long          },
+    { "short",       type_t::t_short         },
+    { "double",      type_t::t_double        },
+    { "float",       type_t::t_float         },
+    { "char",        type_t::t_char          },
+    { "void",        type_t::t_void          },
+    { "std::string", type_t::t_string        },
+    { "std::vector", container_t::c_vector   }, // containers
+    { "std::map",    container_t::c_map      },
+    { "std::tuple",  container_t::c_tuple    },
+    { "unsigned",    modifier_t::m_unsigned  }, // modifiers
+    { "const",       modifier_t::m_const     },
+};
+
+constexpr std::uint32_t keyword_hash(std::string_view word, std::uint32_t seed) noexcept {
+    std::uint32_t hash = seed ^ static_cast<std::uint32_t>(word.size());
+    for (char ch : { word.front(), word[word.size() / 2], word.back() })
+        hash = (hash ^ static_cast<unsigned char>(ch)) * 0x01000193u; // FNV-1a step
+    return hash;
 }
 
-template <typename... Captures>
-inline void fill_token_list_which_keyword(std::unique_ptr<token_list>& my_tokens, std::string& token, ctre::regex_results<Captures...> const& regex_matches, bool& next_token_is_typename) {
-    // Note: c++ 20's string literal operator template + ctre named captures should make this code cleaner and safer
-    auto [ _,
-        is_struct,    // keywords
-        is_inline,
-        is_include,
-        is_int,       // types
-        is_long,
-        is_short,
-        is_double,
-        is_float,
-        is_char,
-        is_void_,
-        is_string,
-        is_vector,    // containers
-        is_map,
-        is_tuple,
-        is_unsigned_, // modifiers
-        is_const_ 
-        ] = regex_matches;
-    if (is_struct) {
-        token_list_push_keyword(my_tokens, token, keyword_t::k_struct);
-        next_token_is_typename = true;
-    } else if (is_inline) {
-        token_list_push_keyword(my_tokens, token, keyword_t::k_inline);
-    } else if (is_include) {
-        token_list_push_keyword(my_tokens, token, keyword_t::k_include);
-    } else if (is_int) {
-        token_list_push_type(my_tokens, token, type_t::t_int);
-    } else if (is_long) {
-        token_list_push_type(my_tokens, token, type_t::t_long);
-    } else if (is_short) {
-        token_list_push_type(my_tokens, token, type_t::t_short);
-    } else if (is_double) {
-        token_list_push_type(my_tokens, token, type_t::t_double);
-    } else if (is_float) {
-        token_list_push_type(my_tokens, token, type_t::t_float);
-    } else if (is_char) {
-        token_list_push_type(my_tokens, token, type_t::t_char);
-    } else if (is_void_) {
-        token_list_push_type(my_tokens, token, type_t::t_void);
-    } else if (is_string) {
-        token_list_push_type(my_tokens, token, type_t::t_string);
-    } else if (is_vector) {
-        token_list_push_container(my_tokens, token, container_t::c_vector);
-    } else if (is_map) {
-        token_list_push_container(my_tokens, token, container_t::c_map);
-    } else if (is_tuple) {
-        token_list_push_container(my_tokens, token, container_t::c_tuple);
-    } else if (is_unsigned_) {
-        token_list_push_modifier(my_tokens, token, modifier_t::m_unsigned);
-    } else if (is_const_) {
-        token_list_push_modifier(my_tokens, token, modifier_t::m_const);
-    } else {
-        std::cerr << "invalid keyword: '" << token << "'\n"; 
-        throw std::invalid_argument("tokenizer: invalid keyword"); 
+inline constexpr std::size_t keyword_slots = 64; // power of 2, keep it well above std::size(keywords)
+
+struct keyword_hash_table {
+    std::uint32_t                            seed;          // 0 when no perfect hash was found
+    std::size_t                              max_length;
+    std::array<std::int8_t, keyword_slots>   slots;         // index into keywords, -1 if empty
+};
+
+constexpr keyword_hash_table make_keyword_hash_table() {
+    std::size_t max_length = 0;
+    for (auto const& keyword : keywords)
+        max_length = std::max(max_length, keyword.spelling.size());
+    for (std::uint32_t seed = 1; seed < 1000000; ++seed) {
+        keyword_hash_table table{ seed, max_length, {} };
+        for (auto& slot : table.slots)
+            slot = -1;
+        bool collision = false;
+        for (std::size_t i = 0; i < std::size(keywords) && !collision; ++i) {
+            auto& slot = table.slots[keyword_hash(keywords[i].spelling, seed) & (keyword_slots - 1)];
+            collision = slot != -1;
+            slot = static_cast<std::int8_t>(i);
+        }
+        if (!collision)
+            return table;
     }
+    return { 0, max_length, {} };
+}
+
+inline constexpr keyword_hash_table keyword_table = make_keyword_hash_table();
+static_assert(keyword_table.seed != 0, "no perfect hash for keywords, increase keyword_slots");
+
+constexpr keyword_entry const* find_keyword(std::string_view word) noexcept {
+    if (word.empty() || word.size() > keyword_table.max_length)
+        return nullptr;
+    auto const index = keyword_table.slots[keyword_hash(word, keyword_table.seed) & (keyword_slots - 1)];
+    if (index < 0 || keywords[index].spelling != word)
+        return nullptr;
+    return &keywords[index];
 }
 
-template <typename... Captures>
-inline void fill_token_list_which_symbol(std::unique_ptr<token_list>& my_tokens,
-                                         char symbol,
-                                         ctre::regex_results<Captures...> const& regex_matches,
-                                         bool& inside_function_def,
-                                         int& scope_depth) {
-    static bool end_of_function_decl = false;
-    auto [ _,
-        is_quot,
-        is_comma,
-        is_lpar,
-        is_rpar,
-        is_lcub,
-        is_rcub,
-        is_semi,
-        is_pound,
-        is_lt,
-        is_gt,
-        is_ptr,
-        is_ref 
-        ] = regex_matches;
-    if (is_quot) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_quot);
-    } else if (is_comma) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_comma);
-    } else if (is_lpar) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_lpar);
-    } else if (is_rpar) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_rpar);
-        end_of_function_decl = true;
-    } else if (is_lcub) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_lcub);
-        if (end_of_function_decl) { inside_function_def = true; ++scope_depth; }
-    } else if (is_rcub) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_rcub);
-        end_of_function_decl = false;
-    } else if (is_semi) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_semi);
-        end_of_function_decl = false;
-    } else if (is_pound) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_pound);
-    } else if (is_lt) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_lt);
-    } else if (is_gt) {
-        token_list_push_symbol(my_tokens, symbol, symbol_t::s_gt);
-    } else if (is_ptr) {
-        token_list_push_modifier(my_tokens, symbol, modifier_t::m_ptr);
-    } else if (is_ref) {
-        token_list_push_modifier(my_tokens, symbol, modifier_t::m_ref);
-    } else {
-        std::cerr << "invalid symbol: '" << symbol << "'\n"; 
-        throw std::invalid_argument("tokenizer: invalid symbol"); 
+// keyword_regex is the reference definition, check each keyword hits its own capture
+constexpr bool keyword_table_matches_regex() {
+    for (std::size_t i = 0; i < std::size(keywords); ++i) {
+        auto const keyword_match = match_keyword(keywords[i].spelling);
+        if (!keyword_match || find_keyword(keywords[i].spelling) != &keywords[i])
+            return false;
+        if (matched_capture(keyword_match, std::make_index_sequence<std::size(keywords)>{}) != static_cast<int>(i + 1))
+            return false;
+    }
+    for (std::string_view word : { "structs", "in", "std::", "Int", "constant", "x", "std::strin", "std:string" }) {
+        if (find_keyword(word) != nullptr || match_keyword(word))
+            return false;
     }
+    return true;
 }
+static_assert(keyword_table_matches_regex(), "keywords table disagrees with keyword_regex");
+
+struct token_list {
+    source_buffer      buffer;  // owns the source when tokenized from a file/ stream, empty when the caller owns it
+    std::string_view   source;
+    std::vector<token> tokens;
+    string_pool        symbols; // identifier & type names, the ast and code generators share these
 
-inline void fill_token_list_keyword_or_identifier(std::unique_ptr<token_list>& my_tokens, std::string& token, std::set<std::string, std::less<>>& new_types) {
-    static bool next_token_is_typename = false;
-    if (!token.empty()) {
-        if (auto keyword_match = match_keyword(token)) {
-            fill_token_list_which_keyword(my_tokens, token, keyword_match, next_token_is_typename);
-        } else if (new_types.find(token) != new_types.end()) {
-            token_list_push_type(my_tokens, token, type_t::t_custom);
+    std::size_t size() const { return tokens.size(); }
+
+    std::string_view value(token const& tok) const { return source.substr(tok.offset, tok.length); }
+
+    void push(token_kind const kind, std::uint8_t const subtype, std::string_view const spelling, string_id const id = 0) {
+        tokens.push_back({ kind, subtype, static_cast<std::uint32_t>(spelling.data() - source.data()), static_cast<std::uint32_t>(spelling.size()), id });
+    }
+
+    // calls vis with the typed view of tok
+    template <typename Visitor>
+    decltype(auto) visit(Visitor&& vis, token const& tok) const {
+        std::string_view const spelling = value(tok);
+        switch (tok.kind) {
+            case token_kind::tk_container  : return vis(container_token  { spelling, static_cast<container_t>(tok.subtype) });
+            case token_kind::tk_identifier : return vis(identifier_token { spelling,                                          symbols[tok.id] });
+            case token_kind::tk_keyword    : return vis(keyword_token    { spelling, static_cast<keyword_t  >(tok.subtype) });
+            case token_kind::tk_modifier   : return vis(modifier_token   { spelling, static_cast<modifier_t >(tok.subtype) });
+            case token_kind::tk_symbol     : return vis(symbol_token     { spelling, static_cast<symbol_t   >(tok.subtype) });
+            case token_kind::tk_type       : return vis(type_token       { spelling, static_cast<type_t     >(tok.subtype), symbols[tok.id] });
+        }
+        throw std::logic_error("token_list: corrupt token kind");
+    }
+};
+
+// All lexing state lives in the tokenizer object, so headers can be tokenized one after another
+// or on several threads at once without one run leaking into the next.
+class tokenizer {
+    std::unique_ptr<token_list> my_tokens;
+    scan_kernels const&         scan;
+    std::vector<bool>           new_types;              // indexed by string_id
+    bool                        next_token_is_typename; // previous token was 'struct'
+    bool                        end_of_function_decl;   // a ')' was seen since the last ';' or '}'
+    bool                        inside_function_def;
+    int                         scope_depth;            // track open & close curly braces within a function
+
+    void push_container(std::string_view token, container_t const c_type) {
+        my_tokens->push(token_kind::tk_container, static_cast<std::uint8_t>(c_type), token);
+    }
+
+    void push_identifier(interned_string token) {
+        my_tokens->push(token_kind::tk_identifier, 0, token, token.id);
+    }
+
+    void push_keyword(std::string_view token, keyword_t const k_type) {
+        my_tokens->push(token_kind::tk_keyword, static_cast<std::uint8_t>(k_type), token);
+    }
+
+    void push_modifier(std::string_view token, modifier_t const m_type) {
+        my_tokens->push(token_kind::tk_modifier, static_cast<std::uint8_t>(m_type), token);
+    }
+
+    void push_symbol(std::string_view token, symbol_t const s_type) {
+        my_tokens->push(token_kind::tk_symbol, static_cast<std::uint8_t>(s_type), token);
+    }
+
+    void push_type(interned_string token, type_t const t_type) {
+        my_tokens->push(token_kind::tk_type, static_cast<std::uint8_t>(t_type), token, token.id);
+    }
+
+    void fill_token_list_which_keyword(std::string_view token, keyword_entry const& keyword) {
+        string_id const id = keyword.kind == token_kind::tk_type ? my_tokens->symbols.intern(token).id : 0;
+        my_tokens->push(keyword.kind, keyword.subtype, token, id);
+        if (keyword.kind == token_kind::tk_keyword && keyword.subtype == static_cast<std::uint8_t>(keyword_t::k_struct))
+            next_token_is_typename = true;
+    }
+
+    void fill_token_list_which_symbol(std::string_view symbol, char_class_entry const& symbol_class) {
+        if (symbol_class.modifier != modifier_t::m_unknown) { // '*' or '&'
+            push_modifier(symbol, symbol_class.modifier);
+            return;
+        }
+        switch (symbol_class.symbol) {
+            case symbol_t::s_rpar:
+                end_of_function_decl = true;
+                break;
+            case symbol_t::s_lcub:
+                if (end_of_function_decl) { inside_function_def = true; ++scope_depth; }
+                break;
+            case symbol_t::s_rcub:
+            case symbol_t::s_semi:
+                end_of_function_decl = false;
+                break;
+            case symbol_t::s_unknown:
+                std::cerr << "invalid symbol: '" << symbol << "'\n"; 
+                throw std::invalid_argument("tokenizer: invalid symbol"); 
+            default:
+                break;
+        }
+        push_symbol(symbol, symbol_class.symbol);
+    }
+
+    void fill_token_list_keyword_or_identifier(std::string_view token) {
+        if (token.empty())
+            return;
+        if (keyword_entry const* keyword = find_keyword(token)) {
+            fill_token_list_which_keyword(token, *keyword);
+            return;
+        }
+        interned_string const name = my_tokens->symbols.intern(token);
+        if (name.id < new_types.size() && new_types[name.id]) {
+            push_type(name, type_t::t_custom);
         } else if (match_identifier(token)) {
             if (next_token_is_typename) {
-                new_types.insert(token);
-                token_list_push_type(my_tokens, token, type_t::t_custom);
+                new_types.resize(std::max<std::size_t>(new_types.size(), name.id + 1));
+                new_types[name.id] = true;
+                push_type(name, type_t::t_custom);
                 next_token_is_typename = false;
             } else {
-                token_list_push_identifier(my_tokens, token);
+                push_identifier(name);
             }
         } else {
             std::cerr << "invalid token: '" << token << "'\n"; 
             throw std::invalid_argument("tokenizer: invalid token"); 
         }
-        token.clear();
     }
-}
 
-inline std::unique_ptr<token_list> tokenize(std::ifstream& ifs) {
-    std::unique_ptr<token_list> my_tokens = std::make_unique<token_list>();
-    std::set<std::string, std::less<>> new_types;
-
-    char next_ch_str[] = { '\0', '\0' }; // regex match wants a string
-    char& next_ch = next_ch_str[0]; // but ifstream.get() wants a char
-    std::string token;
-
-    bool inside_function_def = false;
-    int scope_depth = 0; // track open & close curly braces within a function
-
-    while(!ifs.eof()) {
-        ifs.get(next_ch);
-        if (inside_function_def) { // ignore whatever is inside the function definition
-            if      (next_ch == '{'  ) ++scope_depth;
-            else if (next_ch == '}'  ) --scope_depth;
-            if      (scope_depth != 0)      continue;
-            else    inside_function_def      = false;
-        }
+    void tokenize_source() {
+        std::string_view const source = my_tokens->source;
+        if (source.size() > std::numeric_limits<std::uint32_t>::max())
+            throw std::length_error("tokenizer: source file too large");
+        my_tokens->tokens.reserve(source.size() / 8);
+        my_tokens->symbols.reserve(source.size() / 64);
 
-        if (match_isspace(next_ch_str)) {
-            fill_token_list_keyword_or_identifier(my_tokens, token, new_types);
-        } else if (auto symbol_match = match_symbol(next_ch_str)) {
-            fill_token_list_keyword_or_identifier(my_tokens, token, new_types);
-            fill_token_list_which_symbol(my_tokens, next_ch, symbol_match, inside_function_def, scope_depth);
-        } else {
-            token+=next_ch;
+        char const*       next_ch = source.data();
+        char const* const end     = next_ch + source.size();
+        while (next_ch != end) {
+            if (inside_function_def) { // ignore whatever is inside the function definition
+                next_ch = scan.body_brace(next_ch, end);
+                if      (next_ch == end ) break;
+                if      (*next_ch == '{') ++scope_depth;
+                else                      --scope_depth;
+                if      (scope_depth != 0) { ++next_ch; continue; }
+                else    inside_function_def = false;
+            }
+
+            char_class_entry const& next_ch_class = classify(*next_ch);
+            if (next_ch_class.cls == char_class_t::cc_space) {
+                next_ch = scan.space_end(next_ch + 1, end);
+            } else if (next_ch_class.cls == char_class_t::cc_symbol) {
+                fill_token_list_which_symbol(std::string_view(next_ch, 1), next_ch_class);
+                ++next_ch;
+            } else { // identifier runs always end at whitespace, a symbol or the end of the file
+                char const* const token_end = scan.token_end(next_ch + 1, end);
+                fill_token_list_keyword_or_identifier(std::string_view(next_ch, token_end - next_ch));
+                next_ch = token_end;
+            }
         }
     }
+
+    tokenizer() :
+        my_tokens(std::make_unique<token_list>()),
+        scan(select_scan_kernels()),
+        new_types(),
+        next_token_is_typename(false),
+        end_of_function_decl(false),
+        inside_function_def(false),
+        scope_depth(0) {}
+
+public:
+    // Note: the tokens refer into source, so it must outlive the token_list
+    explicit tokenizer(std::string_view source) : tokenizer() {
+        my_tokens->source = source;
+        tokenize_source();
+    }
+
+    explicit tokenizer(source_buffer&& source) : tokenizer() {
+        my_tokens->buffer = std::move(source);
+        my_tokens->source = my_tokens->buffer.view();
+        tokenize_source();
+    }
+
+    std::unique_ptr<token_list> move_tokens() {
+        return std::move(my_tokens);
+    }
+};
+
+// Note: the tokens refer into source, so it must outlive the returned token_list
+inline std::unique_ptr<token_list> tokenize(std::string_view source) {
+    tokenizer my_tokenizer(source);
+    return my_tokenizer.move_tokens();
+}
+
+inline std::unique_ptr<token_list> tokenize(source_buffer&& source) {
+    tokenizer my_tokenizer(std::move(source));
+    return my_tokenizer.move_tokens();
+}
+
+inline std::unique_ptr<token_list> tokenize(std::ifstream& ifs) {
+    source_buffer source(ifs);
     ifs.close();
-    return my_tokens;
+    return tokenize(std::move(source));
 }
 
 }